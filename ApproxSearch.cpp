@@ -0,0 +1,176 @@
+/*
+ * Myers' bit-vector approximate search; see ApproxSearch.h.
+ *
+ * The text may start anywhere in the pattern's alignment, so the top row
+ * of the matrix is all zeros and no horizontal difference comes in at
+ * the top of the first block.
+ *
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <ApproxSearch.h>
+#include <BytePattern.h>
+
+using std::vector;
+
+namespace bltools {
+
+    static const int WORD = 64;
+    static const uint64_t HIGH_BIT = uint64_t(1) << 63;
+
+    // One text byte through one block: Pv/Mv are the block's vertical
+    // differences, eq its match bits for the byte and hin the horizontal
+    // difference coming in at the top. Returns the one going out at the
+    // bottom.
+    static inline int advanceBlock(uint64_t &pv, uint64_t &mv, uint64_t eq,
+                                   int hin) {
+        uint64_t hin_neg = hin < 0 ? 1 : 0;
+        uint64_t xv = eq | mv;
+        eq |= hin_neg;
+        uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+        uint64_t ph = mv | ~(xh | pv);
+        uint64_t mh = pv & xh;
+        int hout = 0;
+        if(ph & HIGH_BIT) {
+            hout = 1;
+        } else if(mh & HIGH_BIT) {
+            hout = -1;
+        }
+        ph <<= 1;
+        mh <<= 1;
+        mh |= hin_neg;
+        if(hin > 0) ph |= 1;
+        pv = mh | ~(xv | ph);
+        mv = ph & xv;
+        return hout;
+    }
+
+    ApproxSearch::ApproxSearch(const BytePattern &pattern, unsigned max_errors) :
+        m(pattern.size()), k(max_errors),
+        nblocks((pattern.size() + WORD - 1) / WORD), pad_mask(0) {
+
+        peq.assign(256 * nblocks, 0);
+        for(size_t i = 0; i < m; i++) {
+            size_t b = i / WORD;
+            uint64_t bit = uint64_t(1) << (i % WORD);
+            for(int c = 0; c < 256; c++) {
+                if(pattern[i].has(c)) peq[c * nblocks + b] |= bit;
+            }
+        }
+        size_t last_rows = m - (nblocks - 1) * WORD;
+        if(nblocks > 0 && last_rows < (size_t) WORD) {
+            pad_mask = ~uint64_t(0) << last_rows;
+        }
+        pv.resize(nblocks);
+        mv.resize(nblocks);
+        score.resize(nblocks);
+
+        size_t npieces = k + 1;
+        if(m / npieces >= MIN_PIECE) {
+            for(size_t i = 0; i < npieces; i++) {
+                size_t start = i * m / npieces;
+                size_t stop = (i + 1) * m / npieces;
+                BytePattern piece;
+                piece.positions.assign(pattern.positions.begin() + start,
+                                       pattern.positions.begin() + stop);
+                pieces.push_back(FixedSearch(piece));
+                piece_offsets.push_back(start);
+            }
+        }
+    }
+
+    bool ApproxSearch::searchOneWord(const char * begin, const char * end) const {
+        const uint64_t high = uint64_t(1) << (m - 1);
+        uint64_t pv1 = ~uint64_t(0);
+        uint64_t mv1 = 0;
+        int s = m;
+        for(const char * p = begin; p != end; p++) {
+            uint64_t eq = peq[(unsigned char) *p];
+            uint64_t xv = eq | mv1;
+            uint64_t xh = (((eq & pv1) + pv1) ^ pv1) | eq;
+            uint64_t ph = mv1 | ~(xh | pv1);
+            uint64_t mh = pv1 & xh;
+            if(ph & high) {
+                s++;
+            } else if(mh & high) {
+                s--;
+            }
+            ph <<= 1;
+            mh <<= 1;
+            pv1 = mh | ~(xv | ph);
+            mv1 = ph & xv;
+            if(s <= k) return true;
+        }
+        return false;
+    }
+
+    bool ApproxSearch::search(const char * begin, const char * end) {
+        if(m == 0 || begin == end) return false;
+        // Deleting the whole pattern is always an option
+        if((size_t) k >= m) return true;
+        if(pieces.empty()) return searchBlocks(begin, end);
+
+        // A match with a piece at q starts no more than k before the
+        // piece's place in the pattern would put it, and ends no more
+        // than k after the pattern would.
+        size_t n = end - begin;
+        for(size_t i = 0; i < pieces.size(); i++) {
+            const char * from = begin;
+            while(const char * q = pieces[i].find(from, end)) {
+                size_t pos = q - begin;
+                size_t lead = piece_offsets[i] + k;
+                size_t start = pos > lead ? pos - lead : 0;
+                size_t stop = std::min(n, pos - piece_offsets[i] + m + k);
+                if(searchBlocks(begin + start, begin + stop)) return true;
+                from = q + 1;
+            }
+        }
+        return false;
+    }
+
+    bool ApproxSearch::searchBlocks(const char * begin, const char * end) {
+        if(nblocks == 1) return searchOneWord(begin, end);
+
+        // Blocks below last can't have a score of k or less yet
+        size_t last = std::min<size_t>((k + WORD) / WORD, nblocks) - 1;
+        for(size_t b = 0; b <= last; b++) {
+            pv[b] = ~uint64_t(0);
+            mv[b] = 0;
+            score[b] = (b + 1) * WORD;
+        }
+
+        for(const char * p = begin; p != end; p++) {
+            const uint64_t * eq = &peq[(unsigned char) *p * nblocks];
+            int carry = 0;
+            for(size_t b = 0; b <= last; b++) {
+                carry = advanceBlock(pv[b], mv[b], eq[b], carry);
+                score[b] += carry;
+            }
+
+            // Bring in the next block if it could reach k
+            if(last + 1 < nblocks && score[last] - carry <= k &&
+               ((eq[last + 1] & 1) || carry < 0)) {
+                last++;
+                pv[last] = ~uint64_t(0);
+                mv[last] = 0;
+                int h = advanceBlock(pv[last], mv[last], eq[last], carry);
+                score[last] = score[last - 1] - carry + WORD + h;
+            }
+
+            // Drop blocks whose scores are all above k
+            while(last > 0 && score[last] >= k + WORD) last--;
+
+            // Score at the last pattern row, under the padding rows
+            if(last == nblocks - 1) {
+                int d = score[last] - __builtin_popcountll(pv[last] & pad_mask) +
+                    __builtin_popcountll(mv[last] & pad_mask);
+                if(d <= k) return true;
+            }
+        }
+        return false;
+    }
+}
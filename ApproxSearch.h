@@ -0,0 +1,72 @@
+/*
+ * Approximate pattern search with Myers' bit-vector algorithm
+ * (blgrep -e): does the pattern occur anywhere in the text with at most
+ * k mismatches, insertions or deletions?
+ *
+ * One column of the edit distance matrix is kept as bit vectors of
+ * vertical differences, 64 pattern positions per word, and updated with
+ * a handful of word operations per text byte. Patterns longer than 64
+ * are split into blocks; only blocks that could still hold a score of
+ * at most k are updated (Ukkonen's cutoff, as in Myers' paper), so long
+ * patterns with few errors cost little more than short ones.
+ *
+ * Most text can't match at all, so it is filtered first: split the
+ * pattern into k + 1 pieces and at least one of them must occur without
+ * errors in any match. The pieces are found with FixedSearch, which is
+ * much faster than the bit vectors, and only the text around each hit is
+ * checked properly. Pieces shorter than MIN_PIECE would hit too often to
+ * be worth it, so then the whole text goes through the bit vectors.
+ *
+ * The pattern is a BytePattern, so IUPAC codes, case folding and
+ * reversed or complemented strands work the same as for FixedSearch.
+ * As with the other matchers, an empty match doesn't count: an empty
+ * pattern never matches, and the text must be non-empty.
+ *
+ */
+
+#ifndef BLTOOLS_APPROXSEARCH_H
+#define BLTOOLS_APPROXSEARCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <BytePattern.h>
+#include <FixedSearch.h>
+
+using std::vector;
+
+namespace bltools {
+
+    class ApproxSearch {
+
+        private:
+            size_t m;
+            int k;
+            size_t nblocks;
+            vector<uint64_t> peq;       // 256 entries per block
+            uint64_t pad_mask;          // Padding rows of the last block
+
+            // Column state, reused from one search to the next
+            vector<uint64_t> pv;
+            vector<uint64_t> mv;
+            vector<int> score;
+
+            // Filter pieces and where they start in the pattern
+            vector<FixedSearch> pieces;
+            vector<size_t> piece_offsets;
+
+            bool searchOneWord(const char * begin, const char * end) const;
+            bool searchBlocks(const char * begin, const char * end);
+
+        public:
+            static const size_t MIN_PIECE = 5;
+
+            ApproxSearch(const BytePattern &pattern, unsigned max_errors);
+
+            // Not const because it reuses the column state
+            bool search(const char * begin, const char * end);
+    };
+}
+
+#endif
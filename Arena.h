@@ -0,0 +1,81 @@
+/*
+ * Bump allocator for lots of small, long-lived strings (IDs, sequence
+ * segments). Memory comes from large blocks and is only released all at
+ * once, so there is no per-string allocation overhead and pointers stay
+ * valid as the arena grows.
+ *
+ */
+
+#ifndef BLTOOLS_ARENA_H
+#define BLTOOLS_ARENA_H
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+using std::vector;
+
+namespace bltools {
+
+    class Arena {
+
+        private:
+            vector<std::unique_ptr<char[]> > blocks;
+            size_t block_size;
+            size_t used;        // Bytes used in the last block
+            size_t avail;       // Bytes left in the last block
+            size_t total;
+
+        public:
+            explicit Arena(size_t block_size = 1 << 20) :
+                block_size(block_size), used(0), avail(0), total(0) {}
+
+            Arena(const Arena &) = delete;
+            Arena & operator=(const Arena &) = delete;
+
+            char * alloc(size_t n) {
+                if(n > avail || blocks.empty()) {
+                    size_t sz = n > block_size ? n : block_size;
+                    blocks.emplace_back(new char[sz]);
+                    used = 0;
+                    avail = sz;
+                }
+                char * p = blocks.back().get() + used;
+                used += n;
+                avail -= n;
+                total += n;
+                return p;
+            }
+
+            // n bytes at a multiple of align (a power of two) for
+            // structs; new blocks are aligned for anything
+            char * alloc(size_t n, size_t align) {
+                size_t pad = (align - used % align) % align;
+                if(pad + n <= avail) {
+                    used += pad;
+                    avail -= pad;
+                    total += pad;
+                }
+                return alloc(n);
+            }
+
+            const char * copy(const char * data, size_t n) {
+                char * p = alloc(n);
+                if(n > 0) memcpy(p, data, n);
+                return p;
+            }
+
+            // Bytes handed out so far
+            size_t size() const { return total; }
+
+            void clear() {
+                blocks.clear();
+                used = 0;
+                avail = 0;
+                total = 0;
+            }
+    };
+}
+
+#endif
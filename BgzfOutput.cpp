@@ -0,0 +1,263 @@
+/*
+ * Threaded BGZF compression; see BgzfOutput.h.
+ *
+ * The put area is the input buffer of a Block from a fixed pool. When
+ * it fills, the block is numbered and queued for the compressing
+ * threads, and the next free block becomes the put area, waiting for
+ * one if they are all in use. The writer thread takes compressed
+ * blocks in number order and returns them to the pool, noting where
+ * each one ends for the index.
+ *
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <zlib.h>
+
+#include <BgzfOutput.h>
+#include <BoundedQueue.h>
+#include <ReorderBuffer.h>
+
+using std::runtime_error;
+using std::string;
+using std::vector;
+
+namespace bltools {
+
+    // Uncompressed bytes per block, as bgzip uses: small enough that
+    // even incompressible data fits in a 64 KiB block
+    static const size_t BLOCK_DATA = 0xff00;
+    // Header with the BC extra field, and the CRC and size trailer
+    static const size_t HEADER_SIZE = 18;
+    static const size_t TRAILER_SIZE = 8;
+
+    namespace {
+        struct Block {
+            size_t number;
+            vector<char> in;
+            size_t in_size;
+            vector<char> out;
+        };
+
+        void writeLE16(char * p, uint32_t v) {
+            p[0] = v & 0xff;
+            p[1] = (v >> 8) & 0xff;
+        }
+
+        void writeLE32(char * p, uint32_t v) {
+            writeLE16(p, v & 0xffff);
+            writeLE16(p + 2, v >> 16);
+        }
+
+        void writeLE64(std::ostream &out, uint64_t v) {
+            char b[8];
+            writeLE32(b, v & 0xffffffff);
+            writeLE32(b + 4, v >> 32);
+            out.write(b, 8);
+        }
+    }
+
+    struct BgzfStreambuf::State {
+        std::streambuf * sink;
+        vector<Block> pool;
+        BoundedQueue<Block *> free_blocks;
+        BoundedQueue<Block *> todo;
+        BoundedQueue<Block *> done;
+        vector<std::thread> threads;
+        std::atomic<unsigned> running;
+
+        Block * current;
+        size_t submitted;
+        bool closed;
+        std::atomic<bool> failed;
+
+        // Compressed and uncompressed offsets of each block after the
+        // first, as in a .gzi
+        vector<std::pair<uint64_t, uint64_t> > offsets;
+
+        State(std::streambuf * sink, size_t npool) :
+            sink(sink), pool(npool), free_blocks(npool), todo(npool),
+            done(npool), running(0), current(nullptr), submitted(0),
+            closed(false), failed(false) {
+            for(Block &b: pool) {
+                b.in.resize(BLOCK_DATA);
+                b.out.resize(HEADER_SIZE + compressBound(BLOCK_DATA) + TRAILER_SIZE);
+                free_blocks.push(&b);
+            }
+        }
+
+        void compressBlocks();
+        void writeBlocks();
+    };
+
+    void BgzfStreambuf::State::compressBlocks() {
+        z_stream z;
+        memset(&z, 0, sizeof(z));
+        deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                     Z_DEFAULT_STRATEGY);
+        Block * b;
+        while(todo.pop(b)) {
+            char * h = b->out.data();
+            deflateReset(&z);
+            z.next_in = reinterpret_cast<Bytef *>(b->in.data());
+            z.avail_in = b->in_size;
+            z.next_out = reinterpret_cast<Bytef *>(h + HEADER_SIZE);
+            z.avail_out = b->out.size() - HEADER_SIZE - TRAILER_SIZE;
+            deflate(&z, Z_FINISH);
+            size_t size = HEADER_SIZE + z.total_out + TRAILER_SIZE;
+
+            static const char header[HEADER_SIZE - 2] = {
+                31, -117, 8, 4, 0, 0, 0, 0, 0, -1, 6, 0, 'B', 'C', 2, 0
+            };
+            memcpy(h, header, sizeof(header));
+            writeLE16(h + HEADER_SIZE - 2, size - 1);
+            char * trailer = h + size - TRAILER_SIZE;
+            writeLE32(trailer, crc32(0, reinterpret_cast<const Bytef *>(b->in.data()),
+                                     b->in_size));
+            writeLE32(trailer + 4, b->in_size);
+            b->out.resize(size);
+            done.push(b);
+        }
+        deflateEnd(&z);
+        if(--running == 0) done.close();
+    }
+
+    void BgzfStreambuf::State::writeBlocks() {
+        ReorderBuffer<Block *> waiting;
+        uint64_t compressed = 0;
+        uint64_t uncompressed = 0;
+        Block * b;
+        while(done.pop(b)) {
+            waiting.add(b->number, b);
+            Block * w;
+            while(waiting.pop(w)) {
+                std::streamsize n = w->out.size();
+                if(!failed && sink->sputn(w->out.data(), n) != n) failed = true;
+                compressed += n;
+                uncompressed += w->in_size;
+                if(w->in_size > 0) offsets.emplace_back(compressed, uncompressed);
+                w->out.resize(w->out.capacity());
+                free_blocks.push(w);
+            }
+        }
+    }
+
+    BgzfStreambuf::BgzfStreambuf(std::streambuf * sink, unsigned threads) {
+        if(threads == 0) threads = std::thread::hardware_concurrency();
+        if(threads == 0) threads = 1;
+        state.reset(new State(sink, 4 * threads + 4));
+        State &s = *state;
+        s.running = threads;
+        for(unsigned t = 0; t < threads; t++) {
+            s.threads.emplace_back(&State::compressBlocks, &s);
+        }
+        s.threads.emplace_back(&State::writeBlocks, &s);
+        s.free_blocks.pop(s.current);
+        setp(s.current->in.data(), s.current->in.data() + BLOCK_DATA);
+    }
+
+    BgzfStreambuf::~BgzfStreambuf() {
+        close();
+    }
+
+    // Queue the put area for compression and start a new one
+    void BgzfStreambuf::submit() {
+        State &s = *state;
+        s.current->in_size = pptr() - pbase();
+        s.current->number = s.submitted++;
+        s.todo.push(s.current);
+        s.current = nullptr;
+        s.free_blocks.pop(s.current);
+        setp(s.current->in.data(), s.current->in.data() + BLOCK_DATA);
+    }
+
+    BgzfStreambuf::int_type BgzfStreambuf::overflow(int_type c) {
+        if(state->closed) return traits_type::eof();
+        if(pptr() > pbase()) submit();
+        if(!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    // Blocks are cut by size alone, so a flush doesn't end one
+    int BgzfStreambuf::sync() {
+        return state->failed ? -1 : 0;
+    }
+
+    bool BgzfStreambuf::close() {
+        State &s = *state;
+        if(s.closed) return !s.failed;
+
+        // What's left, then the empty end-of-file block
+        if(pptr() > pbase()) submit();
+        s.current->in_size = 0;
+        s.current->number = s.submitted++;
+        s.todo.push(s.current);
+        s.current = nullptr;
+        setp(nullptr, nullptr);
+
+        s.todo.close();
+        for(std::thread &t: s.threads) t.join();
+        s.free_blocks.close();
+        s.closed = true;
+        if(s.sink->pubsync() != 0) s.failed = true;
+        return !s.failed;
+    }
+
+    void BgzfStreambuf::writeIndex(std::ostream &out) const {
+        writeLE64(out, state->offsets.size());
+        for(const std::pair<uint64_t, uint64_t> &o: state->offsets) {
+            writeLE64(out, o.first);
+            writeLE64(out, o.second);
+        }
+    }
+
+    BgzfCout::BgzfCout(const string &index_path, unsigned threads) {
+        if(!index_path.empty()) {
+            index.open(index_path.c_str(), std::ios::out | std::ios::binary);
+            if(!index.is_open()) {
+                throw runtime_error("Could not open " + index_path);
+            }
+        }
+        original = std::cout.rdbuf();
+        buf.reset(new BgzfStreambuf(original, threads));
+        std::cout.rdbuf(buf.get());
+    }
+
+    BgzfCout::~BgzfCout() {
+        std::cout.flush();
+        std::cout.rdbuf(original);
+        bool ok = buf->close();
+        if(index.is_open()) {
+            buf->writeIndex(index);
+            index.close();
+        }
+        if(!ok) std::cerr << "Error writing compressed output" << std::endl;
+    }
+
+    bool compressCout(bool bgzf, const string &index_path,
+                      std::unique_ptr<BgzfCout> &out) {
+        if(!bgzf) {
+            if(index_path.empty()) return true;
+            std::cerr << "Error: --gzi only works with -z" << std::endl;
+            return false;
+        }
+        try {
+            out.reset(new BgzfCout(index_path));
+        } catch(std::exception const &e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return false;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,84 @@
+/*
+ * BGZF output for every tool (-z).
+ *
+ * BGZF is gzip made of independent blocks of up to 64 KiB, so anything
+ * that reads gzip reads it, and with a .gzi index (--gzi, the format
+ * bgzip -i writes) it can be read from any offset. BgzfStreambuf cuts
+ * what is written to it into blocks, a pool of threads compresses them,
+ * and a writer thread puts them out in order, followed by the empty
+ * block that marks the end of a BGZF file.
+ *
+ * Blocks are only cut when they're full: flushing (endl) doesn't end a
+ * block, so the output is the same however it was written, and nothing
+ * is guaranteed to reach the sink before close().
+ *
+ * BgzfCout is how tools use it: while one exists everything written to
+ * std::cout, by SeqFileOut or otherwise, is compressed.
+ *
+ */
+
+#ifndef BLTOOLS_BGZFOUTPUT_H
+#define BLTOOLS_BGZFOUTPUT_H
+
+#include <fstream>
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <string>
+
+using std::string;
+
+namespace bltools {
+
+    class BgzfStreambuf : public std::streambuf {
+
+        private:
+            struct State;
+            std::unique_ptr<State> state;
+
+            void submit();
+
+        protected:
+            int_type overflow(int_type c) override;
+            int sync() override;
+
+        public:
+            // Compress into sink, which must outlive this, on threads
+            // threads; 0 for one per core
+            explicit BgzfStreambuf(std::streambuf * sink, unsigned threads = 0);
+            ~BgzfStreambuf();
+
+            BgzfStreambuf(const BgzfStreambuf &) = delete;
+            BgzfStreambuf & operator=(const BgzfStreambuf &) = delete;
+
+            // Write what's left and the end-of-file block; false if
+            // writing to the sink failed. Nothing may be written after.
+            bool close();
+
+            // The .gzi index of the blocks written, once closed
+            void writeIndex(std::ostream &out) const;
+    };
+
+    class BgzfCout {
+
+        private:
+            std::streambuf * original;
+            std::unique_ptr<BgzfStreambuf> buf;
+            std::ofstream index;
+
+        public:
+            // Throws runtime_error if index_path can't be written
+            explicit BgzfCout(const string &index_path = "", unsigned threads = 0);
+            ~BgzfCout();
+
+            BgzfCout(const BgzfCout &) = delete;
+            BgzfCout & operator=(const BgzfCout &) = delete;
+    };
+
+    // A tool's -z and --gzi: compress cout into out if bgzf is set.
+    // Prints an error and returns false if that can't be done.
+    bool compressCout(bool bgzf, const string &index_path,
+                      std::unique_ptr<BgzfCout> &out);
+}
+
+#endif
@@ -0,0 +1,74 @@
+/*
+ * Blocking queue with a fixed capacity, for handing work between
+ * threads. push() waits while the queue is full, so a fast producer
+ * can't run ahead of its consumers and use up memory.
+ *
+ * close() wakes everyone up: after it, push() fails and pop() fails
+ * once whatever was queued before has been taken.
+ *
+ */
+
+#ifndef BLTOOLS_BOUNDEDQUEUE_H
+#define BLTOOLS_BOUNDEDQUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+namespace bltools {
+
+    template <typename T>
+    class BoundedQueue {
+
+        private:
+            std::mutex lock;
+            std::condition_variable not_empty;
+            std::condition_variable not_full;
+            std::deque<T> items;
+            size_t capacity;
+            bool closed;
+
+        public:
+            explicit BoundedQueue(size_t capacity) :
+                capacity(capacity > 0 ? capacity : 1), closed(false) {}
+
+            BoundedQueue(const BoundedQueue &) = delete;
+            BoundedQueue & operator=(const BoundedQueue &) = delete;
+
+            // False if the queue was closed, in which case item is dropped
+            bool push(T item) {
+                std::unique_lock<std::mutex> guard(lock);
+                not_full.wait(guard, [this] {
+                    return closed || items.size() < capacity;
+                });
+                if(closed) return false;
+                items.push_back(std::move(item));
+                not_empty.notify_one();
+                return true;
+            }
+
+            // False once the queue is closed and empty
+            bool pop(T &item) {
+                std::unique_lock<std::mutex> guard(lock);
+                not_empty.wait(guard, [this] {
+                    return closed || !items.empty();
+                });
+                if(items.empty()) return false;
+                item = std::move(items.front());
+                items.pop_front();
+                not_full.notify_one();
+                return true;
+            }
+
+            void close() {
+                std::lock_guard<std::mutex> guard(lock);
+                closed = true;
+                not_empty.notify_all();
+                not_full.notify_all();
+            }
+    };
+}
+
+#endif
@@ -0,0 +1,162 @@
+/*
+ * A fixed-length pattern where every position is a set of allowed bytes.
+ *
+ * This covers plain strings, case-insensitive strings and IUPAC
+ * nucleotide patterns with one representation, so the search code never
+ * needs to know which kind of pattern it was given.
+ *
+ * With IUPAC codes, a sequence base matches a pattern position if every
+ * base it stands for is allowed there: pattern R matches A, G and R, and
+ * pattern N matches any nucleotide code, but a sequence N only matches a
+ * pattern N. U is treated as T.
+ *
+ * Patterns can be reversed and complemented, so a search of the reverse
+ * or complement strand of a sequence can run on the sequence itself.
+ *
+ */
+
+#ifndef BLTOOLS_BYTEPATTERN_H
+#define BLTOOLS_BYTEPATTERN_H
+
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+namespace bltools {
+
+    // Complement of a base the way SeqAn's Dna5 complement gives it:
+    // upper case, and N for anything other than A, C, G, T or U.
+    inline char complementBase(unsigned char c) {
+        switch(toupper(c)) {
+        case 'A': return 'T';
+        case 'C': return 'G';
+        case 'G': return 'C';
+        case 'T': case 'U': return 'A';
+        default: return 'N';
+        }
+    }
+
+    struct ByteSet {
+
+        uint64_t bits[4];
+
+        ByteSet() : bits{0, 0, 0, 0} {}
+
+        void add(unsigned char c) { bits[c >> 6] |= uint64_t(1) << (c & 63); }
+        bool has(unsigned char c) const {
+            return (bits[c >> 6] >> (c & 63)) & 1;
+        }
+        size_t count() const {
+            return __builtin_popcountll(bits[0]) + __builtin_popcountll(bits[1]) +
+                __builtin_popcountll(bits[2]) + __builtin_popcountll(bits[3]);
+        }
+        // Members in increasing order
+        vector<unsigned char> members() const {
+            vector<unsigned char> m;
+            for(int c = 0; c < 256; c++) if(has(c)) m.push_back(c);
+            return m;
+        }
+        // Bytes whose complement is in the set: matching the complement
+        // of the text against this set is matching the text against that.
+        ByteSet complemented() const {
+            ByteSet s;
+            for(int c = 0; c < 256; c++) if(has(complementBase(c))) s.add(c);
+            return s;
+        }
+    };
+
+    // Bases (A=1, C=2, G=4, T=8) that an IUPAC code stands for; 0 if the
+    // character isn't a nucleotide code.
+    inline unsigned iupacBits(unsigned char c) {
+        switch(toupper(c)) {
+        case 'A': return 1;
+        case 'C': return 2;
+        case 'G': return 4;
+        case 'T': case 'U': return 8;
+        case 'R': return 1 | 4;
+        case 'Y': return 2 | 8;
+        case 'S': return 2 | 4;
+        case 'W': return 1 | 8;
+        case 'K': return 4 | 8;
+        case 'M': return 1 | 2;
+        case 'B': return 2 | 4 | 8;
+        case 'D': return 1 | 4 | 8;
+        case 'H': return 1 | 2 | 8;
+        case 'V': return 1 | 2 | 4;
+        case 'N': return 1 | 2 | 4 | 8;
+        default: return 0;
+        }
+    }
+
+    class BytePattern {
+
+        public:
+            vector<ByteSet> positions;
+
+            size_t size() const { return positions.size(); }
+            bool empty() const { return positions.empty(); }
+            const ByteSet & operator[](size_t i) const { return positions[i]; }
+
+            // True if every position allows exactly one byte
+            bool isExact() const {
+                for(const ByteSet &s: positions) if(s.count() != 1) return false;
+                return true;
+            }
+
+            BytePattern reversed() const {
+                BytePattern p;
+                p.positions.assign(positions.rbegin(), positions.rend());
+                return p;
+            }
+
+            BytePattern complemented() const {
+                BytePattern p;
+                for(const ByteSet &s: positions) p.positions.push_back(s.complemented());
+                return p;
+            }
+
+            static BytePattern literal(const string &s, bool icase) {
+                BytePattern p;
+                for(const char &ch: s) {
+                    unsigned char c = ch;
+                    ByteSet set;
+                    set.add(c);
+                    if(icase) {
+                        set.add(tolower(c));
+                        set.add(toupper(c));
+                    }
+                    p.positions.push_back(set);
+                }
+                return p;
+            }
+
+            static BytePattern iupac(const string &s, bool icase) {
+                BytePattern p;
+                for(const char &ch: s) {
+                    unsigned char c = ch;
+                    unsigned code = iupacBits(c);
+                    if(code == 0) {
+                        BytePattern lit = literal(string(1, ch), icase);
+                        p.positions.push_back(lit.positions[0]);
+                        continue;
+                    }
+                    ByteSet set;
+                    for(int y = 0; y < 256; y++) {
+                        unsigned ycode = iupacBits(y);
+                        if(ycode == 0 || (ycode & ~code) != 0) continue;
+                        if(!icase && (bool) isupper(y) != (bool) isupper(c)) continue;
+                        set.add(y);
+                    }
+                    p.positions.push_back(set);
+                }
+                return p;
+            }
+    };
+}
+
+#endif
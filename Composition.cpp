@@ -0,0 +1,180 @@
+/*
+ * SSE2/AVX2 base counting with run time dispatch; see Composition.h.
+ *
+ * The vector loops count every class but "other", which is whatever is
+ * left over. Letters are folded to lower case by setting bit 5; only 'A'
+ * and 'a' end up as 'a' that way, and so on, but gaps and line breaks
+ * are compared unfolded since '\r' | 0x20 is '-'.
+ *
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+#include <Composition.h>
+#include <SimdLevel.h>
+
+namespace bltools {
+
+    // Classes counted by the vector loops, in BaseClass order
+    static const int NCOUNTED = 7;
+    static const BaseClass counted[NCOUNTED] = {
+        BASE_A, BASE_C, BASE_G, BASE_T, BASE_N, BASE_GAP, BASE_EOL
+    };
+
+    // Byte lanes overflow after 255 matches
+    static const size_t FLUSH_BLOCKS = 255;
+
+    struct ClassTable {
+        unsigned char cls[256];
+
+        ClassTable() {
+            for(int c = 0; c < 256; c++) cls[c] = BASE_OTHER;
+            const char * bases = "ACGTN";
+            for(int i = 0; bases[i]; i++) {
+                cls[(unsigned char) bases[i]] = i;
+                cls[(unsigned char) bases[i] + 32] = i;
+            }
+            cls['U'] = cls['u'] = BASE_T;
+            cls['-'] = BASE_GAP;
+            cls['\n'] = cls['\r'] = BASE_EOL;
+        }
+    };
+
+    static const ClassTable class_table;
+
+    static void addScalar(uint64_t * counts, const unsigned char * p,
+                          const unsigned char * end) {
+        for(; p != end; p++) counts[class_table.cls[*p]]++;
+    }
+
+#ifdef BLTOOLS_X86
+
+    __attribute__((target("avx2")))
+    static size_t addAvx2(uint64_t * counts, const unsigned char * p, size_t n) {
+        const __m256i fold = _mm256_set1_epi8(0x20);
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i ca = _mm256_set1_epi8('a');
+        const __m256i cc = _mm256_set1_epi8('c');
+        const __m256i cg = _mm256_set1_epi8('g');
+        const __m256i ct = _mm256_set1_epi8('t');
+        const __m256i cu = _mm256_set1_epi8('u');
+        const __m256i cn = _mm256_set1_epi8('n');
+        const __m256i cgap = _mm256_set1_epi8('-');
+        const __m256i clf = _mm256_set1_epi8('\n');
+        const __m256i ccr = _mm256_set1_epi8('\r');
+        __m256i sums[NCOUNTED];
+        for(__m256i &s: sums) s = zero;
+        uint64_t other = n / 32 * 32;
+
+        size_t nblocks = n / 32;
+        const __m256i * v = (const __m256i *) p;
+        while(nblocks > 0) {
+            size_t run = nblocks < FLUSH_BLOCKS ? nblocks : FLUSH_BLOCKS;
+            __m256i acc[NCOUNTED];
+            for(__m256i &a: acc) a = zero;
+            for(size_t i = 0; i < run; i++, v++) {
+                __m256i x = _mm256_loadu_si256(v);
+                __m256i f = _mm256_or_si256(x, fold);
+                // Matches are -1, so subtracting them counts up
+                acc[0] = _mm256_sub_epi8(acc[0], _mm256_cmpeq_epi8(f, ca));
+                acc[1] = _mm256_sub_epi8(acc[1], _mm256_cmpeq_epi8(f, cc));
+                acc[2] = _mm256_sub_epi8(acc[2], _mm256_cmpeq_epi8(f, cg));
+                acc[3] = _mm256_sub_epi8(acc[3], _mm256_or_si256(
+                    _mm256_cmpeq_epi8(f, ct), _mm256_cmpeq_epi8(f, cu)));
+                acc[4] = _mm256_sub_epi8(acc[4], _mm256_cmpeq_epi8(f, cn));
+                acc[5] = _mm256_sub_epi8(acc[5], _mm256_cmpeq_epi8(x, cgap));
+                acc[6] = _mm256_sub_epi8(acc[6], _mm256_or_si256(
+                    _mm256_cmpeq_epi8(x, clf), _mm256_cmpeq_epi8(x, ccr)));
+            }
+            for(int k = 0; k < NCOUNTED; k++) {
+                sums[k] = _mm256_add_epi64(sums[k], _mm256_sad_epu8(acc[k], zero));
+            }
+            nblocks -= run;
+        }
+
+        for(int k = 0; k < NCOUNTED; k++) {
+            uint64_t lanes[4];
+            _mm256_storeu_si256((__m256i *) lanes, sums[k]);
+            uint64_t got = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+            counts[counted[k]] += got;
+            other -= got;
+        }
+        counts[BASE_OTHER] += other;
+        return n / 32 * 32;
+    }
+
+    __attribute__((target("sse2")))
+    static size_t addSse2(uint64_t * counts, const unsigned char * p, size_t n) {
+        const __m128i fold = _mm_set1_epi8(0x20);
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i ca = _mm_set1_epi8('a');
+        const __m128i cc = _mm_set1_epi8('c');
+        const __m128i cg = _mm_set1_epi8('g');
+        const __m128i ct = _mm_set1_epi8('t');
+        const __m128i cu = _mm_set1_epi8('u');
+        const __m128i cn = _mm_set1_epi8('n');
+        const __m128i cgap = _mm_set1_epi8('-');
+        const __m128i clf = _mm_set1_epi8('\n');
+        const __m128i ccr = _mm_set1_epi8('\r');
+        __m128i sums[NCOUNTED];
+        for(__m128i &s: sums) s = zero;
+        uint64_t other = n / 16 * 16;
+
+        size_t nblocks = n / 16;
+        const __m128i * v = (const __m128i *) p;
+        while(nblocks > 0) {
+            size_t run = nblocks < FLUSH_BLOCKS ? nblocks : FLUSH_BLOCKS;
+            __m128i acc[NCOUNTED];
+            for(__m128i &a: acc) a = zero;
+            for(size_t i = 0; i < run; i++, v++) {
+                __m128i x = _mm_loadu_si128(v);
+                __m128i f = _mm_or_si128(x, fold);
+                acc[0] = _mm_sub_epi8(acc[0], _mm_cmpeq_epi8(f, ca));
+                acc[1] = _mm_sub_epi8(acc[1], _mm_cmpeq_epi8(f, cc));
+                acc[2] = _mm_sub_epi8(acc[2], _mm_cmpeq_epi8(f, cg));
+                acc[3] = _mm_sub_epi8(acc[3], _mm_or_si128(
+                    _mm_cmpeq_epi8(f, ct), _mm_cmpeq_epi8(f, cu)));
+                acc[4] = _mm_sub_epi8(acc[4], _mm_cmpeq_epi8(f, cn));
+                acc[5] = _mm_sub_epi8(acc[5], _mm_cmpeq_epi8(x, cgap));
+                acc[6] = _mm_sub_epi8(acc[6], _mm_or_si128(
+                    _mm_cmpeq_epi8(x, clf), _mm_cmpeq_epi8(x, ccr)));
+            }
+            for(int k = 0; k < NCOUNTED; k++) {
+                sums[k] = _mm_add_epi64(sums[k], _mm_sad_epu8(acc[k], zero));
+            }
+            nblocks -= run;
+        }
+
+        for(int k = 0; k < NCOUNTED; k++) {
+            uint64_t lanes[2];
+            _mm_storeu_si128((__m128i *) lanes, sums[k]);
+            uint64_t got = lanes[0] + lanes[1];
+            counts[counted[k]] += got;
+            other -= got;
+        }
+        counts[BASE_OTHER] += other;
+        return n / 16 * 16;
+    }
+
+#endif
+
+    void Composition::add(const char * begin, const char * end) {
+        const unsigned char * p = (const unsigned char *) begin;
+        size_t n = end - begin;
+        size_t done = 0;
+#ifdef BLTOOLS_X86
+        switch(simdLevel()) {
+        case SIMD_AVX2:
+            done = addAvx2(counts, p, n);
+            break;
+        case SIMD_SSE2:
+            done = addSse2(counts, p, n);
+            break;
+        default:
+            break;
+        }
+#endif
+        addScalar(counts, p + done, p + n);
+    }
+}
@@ -0,0 +1,59 @@
+/*
+ * Base composition of a sequence (blwc -g, -b, -B, --composition).
+ *
+ * One pass over the bytes counts A, C, G, T (U counts as T), N, gaps
+ * ('-') and everything else, upper and lower case together. Line breaks
+ * ('\n' and '\r') are counted separately and are not bases, so raw
+ * stretches of a file can be counted as well as joined sequences.
+ *
+ * 32 (AVX2) or 16 (SSE2) bytes are compared against each class at once
+ * and the matches summed in byte lanes, which are flushed to the 64-bit
+ * counts before they can overflow. The instruction set is picked at run
+ * time; other CPUs use a table lookup per byte.
+ *
+ */
+
+#ifndef BLTOOLS_COMPOSITION_H
+#define BLTOOLS_COMPOSITION_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace bltools {
+
+    enum BaseClass {
+        BASE_A, BASE_C, BASE_G, BASE_T, BASE_N, BASE_GAP, BASE_OTHER,
+        BASE_EOL, NBASECLASSES
+    };
+
+    struct Composition {
+        uint64_t counts[NBASECLASSES];
+
+        Composition() { clear(); }
+
+        void clear() {
+            for(uint64_t &c: counts) c = 0;
+        }
+
+        // Add the bytes in [begin, end) to the counts
+        void add(const char * begin, const char * end);
+
+        Composition & operator+=(const Composition &other) {
+            for(int i = 0; i < NBASECLASSES; i++) counts[i] += other.counts[i];
+            return *this;
+        }
+
+        uint64_t operator[](BaseClass c) const { return counts[c]; }
+
+        uint64_t gc() const { return counts[BASE_G] + counts[BASE_C]; }
+
+        // Everything but line breaks, and gaps only if asked for
+        uint64_t bases(bool include_gaps) const {
+            uint64_t n = counts[BASE_A] + counts[BASE_C] + counts[BASE_G] +
+                counts[BASE_T] + counts[BASE_N] + counts[BASE_OTHER];
+            return include_gaps ? n + counts[BASE_GAP] : n;
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,43 @@
+/*
+ * Counting operator new for debug builds; see DebugAllocs.h.
+ *
+ */
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include <DebugAllocs.h>
+
+#ifdef BLTOOLS_DEBUG_ALLOCS
+
+static std::atomic<size_t> nallocs(0);
+
+// The array and nothrow forms call these by default
+void * operator new(size_t n) {
+    nallocs.fetch_add(1, std::memory_order_relaxed);
+    void * p = malloc(n > 0 ? n : 1);
+    if(p == nullptr) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void * p) noexcept {
+    free(p);
+}
+
+void operator delete(void * p, size_t) noexcept {
+    free(p);
+}
+
+#endif
+
+namespace bltools {
+
+    size_t allocationCount() {
+#ifdef BLTOOLS_DEBUG_ALLOCS
+        return nallocs.load(std::memory_order_relaxed);
+#else
+        return 0;
+#endif
+    }
+}
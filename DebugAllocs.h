@@ -0,0 +1,22 @@
+/*
+ * Allocation counting for debug builds.
+ *
+ * When compiled with BLTOOLS_DEBUG_ALLOCS defined (make debug), the
+ * global operator new is replaced by one that counts its calls, so a
+ * tool can check that a loop really runs without allocating. Otherwise
+ * nothing is replaced and allocationCount() is always 0.
+ *
+ */
+
+#ifndef BLTOOLS_DEBUGALLOCS_H
+#define BLTOOLS_DEBUGALLOCS_H
+
+#include <cstddef>
+
+namespace bltools {
+
+    // Number of operator new calls so far, in all threads
+    size_t allocationCount();
+}
+
+#endif
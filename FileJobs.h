@@ -0,0 +1,132 @@
+/*
+ * Working on several input files at once (-j) with the output still in
+ * command-line order, byte for byte what a serial run gives.
+ *
+ * Files are dealt out round robin to one deque per thread. A thread
+ * takes files from the front of its own deque, lowest first, and when
+ * that runs out steals from the back of the fullest other one, so a few
+ * large files don't leave the other threads idle. Each file's job
+ * writes to its own buffers, and a thread that finishes one queues its
+ * number; the calling thread puts those back in order and prints each
+ * file's buffers (stdout, then stderr) once every file before it has
+ * been printed.
+ *
+ * A job returns 0, or an exit status if it failed. As in a serial run
+ * nothing is printed after the first failed file, and files after it
+ * that haven't been started are skipped.
+ *
+ */
+
+#ifndef BLTOOLS_FILEJOBS_H
+#define BLTOOLS_FILEJOBS_H
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <BoundedQueue.h>
+#include <ReorderBuffer.h>
+
+namespace bltools {
+
+    // job(i, out, err) handles file i, writing to out and err
+    template <typename Job>
+    int runFileJobs(size_t nfiles, unsigned njobs, Job job) {
+
+        if(njobs < 2 || nfiles < 2) {
+            for(size_t i = 0; i < nfiles; i++) {
+                int status = job(i, std::cout, std::cerr);
+                if(status != 0) return status;
+            }
+            return 0;
+        }
+        if(njobs > nfiles) njobs = nfiles;
+
+        struct Result {
+            std::ostringstream out;
+            std::ostringstream err;
+            int status = 0;
+        };
+        std::vector<Result> results(nfiles);
+        BoundedQueue<size_t> finished(nfiles);
+        std::atomic<size_t> first_failed(nfiles);
+
+        std::vector<std::deque<size_t>> todo(njobs);
+        std::vector<std::mutex> todo_locks(njobs);
+        for(size_t i = 0; i < nfiles; i++) todo[i % njobs].push_back(i);
+
+        // Next file for thread t, false when there's nothing left
+        auto take = [&](unsigned t, size_t &i) {
+            {
+                std::lock_guard<std::mutex> guard(todo_locks[t]);
+                if(!todo[t].empty()) {
+                    i = todo[t].front();
+                    todo[t].pop_front();
+                    return true;
+                }
+            }
+            for(;;) {
+                unsigned victim = njobs;
+                size_t most = 0;
+                for(unsigned v = 0; v < njobs; v++) {
+                    std::lock_guard<std::mutex> guard(todo_locks[v]);
+                    if(todo[v].size() > most) {
+                        most = todo[v].size();
+                        victim = v;
+                    }
+                }
+                if(victim == njobs) return false;
+                std::lock_guard<std::mutex> guard(todo_locks[victim]);
+                if(!todo[victim].empty()) {
+                    i = todo[victim].back();
+                    todo[victim].pop_back();
+                    return true;
+                }
+            }
+        };
+
+        auto work = [&](unsigned t) {
+            size_t i;
+            while(take(t, i)) {
+                Result &r = results[i];
+                if(i < first_failed) {
+                    r.status = job(i, r.out, r.err);
+                    if(r.status != 0) {
+                        size_t seen = first_failed;
+                        while(i < seen && !first_failed.compare_exchange_weak(seen, i)) {}
+                    }
+                }
+                finished.push(i);
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for(unsigned t = 0; t < njobs; t++) threads.emplace_back(work, t);
+
+        // Every file is finished sooner or later, skipped or not
+        ReorderBuffer<size_t> waiting;
+        int status = 0;
+        while(waiting.next() < nfiles && status == 0) {
+            size_t i = 0;
+            while(!waiting.pop(i)) {
+                finished.pop(i);
+                waiting.add(i, i);
+            }
+            Result &r = results[i];
+            std::cout << r.out.str();
+            std::cerr << r.err.str();
+            status = r.status;
+            r.out.str("");
+            r.err.str("");
+        }
+        for(std::thread &t: threads) t.join();
+        return status;
+    }
+}
+
+#endif
@@ -0,0 +1,171 @@
+/*
+ * SSE2/AVX2 fixed pattern search with run time dispatch; see
+ * FixedSearch.h.
+ *
+ */
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <BytePattern.h>
+#include <FixedSearch.h>
+#include <SimdLevel.h>
+
+using std::string;
+using std::vector;
+
+namespace bltools {
+
+    FixedSearch::FixedSearch(const BytePattern &pattern) :
+        pat(pattern), exact(pattern.isExact()), have_anchors(false) {
+
+        if(exact) {
+            for(const ByteSet &s: pat.positions) exact_bytes += s.members()[0];
+        }
+
+        // First and last positions selective enough to filter on
+        size_t first = pat.size();
+        size_t last = pat.size();
+        for(size_t i = 0; i < pat.size(); i++) {
+            if(pat[i].count() > MAX_ANCHOR_BYTES) continue;
+            if(first == pat.size()) first = i;
+            last = i;
+        }
+        if(first < pat.size()) {
+            have_anchors = true;
+            anchors[0] = first;
+            anchors[1] = last;
+            anchor_bytes[0] = pat[first].members();
+            anchor_bytes[1] = pat[last].members();
+        }
+    }
+
+    bool FixedSearch::matchAt(const char * p) const {
+        if(exact) {
+            return memcmp(p, exact_bytes.data(), exact_bytes.size()) == 0;
+        }
+        for(size_t i = 0; i < pat.size(); i++) {
+            if(!pat[i].has(p[i])) return false;
+        }
+        return true;
+    }
+
+    const char * FixedSearch::findScalar(const char * begin,
+                                         const char * end) const {
+        size_t m = pat.size();
+        const char * last = end - m;
+        if(exact) {
+            // memchr on the first byte is already vectorized by libc
+            for(const char * p = begin; p <= last; p++) {
+                p = static_cast<const char *>(memchr(p, exact_bytes[0], last - p + 1));
+                if(p == nullptr) return nullptr;
+                if(matchAt(p)) return p;
+            }
+            return nullptr;
+        }
+        for(const char * p = begin; p <= last; p++) {
+            if(matchAt(p)) return p;
+        }
+        return nullptr;
+    }
+
+#ifdef BLTOOLS_X86
+
+    __attribute__((target("avx2")))
+    static const char * findAvx2(const FixedSearch &fs, const char * begin,
+                                 const char * end) {
+        const vector<unsigned char> &b0 = fs.anchorBytes(0);
+        const vector<unsigned char> &b1 = fs.anchorBytes(1);
+        __m256i s0[FixedSearch::MAX_ANCHOR_BYTES];
+        __m256i s1[FixedSearch::MAX_ANCHOR_BYTES];
+        for(size_t k = 0; k < b0.size(); k++) s0[k] = _mm256_set1_epi8(b0[k]);
+        for(size_t k = 0; k < b1.size(); k++) s1[k] = _mm256_set1_epi8(b1[k]);
+        size_t a0 = fs.anchor(0);
+        size_t a1 = fs.anchor(1);
+
+        size_t nstarts = end - begin - fs.pattern().size() + 1;
+        size_t i = 0;
+        for(; i + 32 <= nstarts; i += 32) {
+            __m256i x = _mm256_loadu_si256((const __m256i *) (begin + i + a0));
+            __m256i y = _mm256_loadu_si256((const __m256i *) (begin + i + a1));
+            __m256i ex = _mm256_cmpeq_epi8(x, s0[0]);
+            for(size_t k = 1; k < b0.size(); k++) {
+                ex = _mm256_or_si256(ex, _mm256_cmpeq_epi8(x, s0[k]));
+            }
+            __m256i ey = _mm256_cmpeq_epi8(y, s1[0]);
+            for(size_t k = 1; k < b1.size(); k++) {
+                ey = _mm256_or_si256(ey, _mm256_cmpeq_epi8(y, s1[k]));
+            }
+            uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(ex, ey));
+            while(mask != 0) {
+                const char * p = begin + i + __builtin_ctz(mask);
+                if(fs.matchAt(p)) return p;
+                mask &= mask - 1;
+            }
+        }
+        for(; i < nstarts; i++) {
+            if(fs.matchAt(begin + i)) return begin + i;
+        }
+        return nullptr;
+    }
+
+    __attribute__((target("sse2")))
+    static const char * findSse2(const FixedSearch &fs, const char * begin,
+                                 const char * end) {
+        const vector<unsigned char> &b0 = fs.anchorBytes(0);
+        const vector<unsigned char> &b1 = fs.anchorBytes(1);
+        __m128i s0[FixedSearch::MAX_ANCHOR_BYTES];
+        __m128i s1[FixedSearch::MAX_ANCHOR_BYTES];
+        for(size_t k = 0; k < b0.size(); k++) s0[k] = _mm_set1_epi8(b0[k]);
+        for(size_t k = 0; k < b1.size(); k++) s1[k] = _mm_set1_epi8(b1[k]);
+        size_t a0 = fs.anchor(0);
+        size_t a1 = fs.anchor(1);
+
+        size_t nstarts = end - begin - fs.pattern().size() + 1;
+        size_t i = 0;
+        for(; i + 16 <= nstarts; i += 16) {
+            __m128i x = _mm_loadu_si128((const __m128i *) (begin + i + a0));
+            __m128i y = _mm_loadu_si128((const __m128i *) (begin + i + a1));
+            __m128i ex = _mm_cmpeq_epi8(x, s0[0]);
+            for(size_t k = 1; k < b0.size(); k++) {
+                ex = _mm_or_si128(ex, _mm_cmpeq_epi8(x, s0[k]));
+            }
+            __m128i ey = _mm_cmpeq_epi8(y, s1[0]);
+            for(size_t k = 1; k < b1.size(); k++) {
+                ey = _mm_or_si128(ey, _mm_cmpeq_epi8(y, s1[k]));
+            }
+            uint32_t mask = _mm_movemask_epi8(_mm_and_si128(ex, ey));
+            while(mask != 0) {
+                const char * p = begin + i + __builtin_ctz(mask);
+                if(fs.matchAt(p)) return p;
+                mask &= mask - 1;
+            }
+        }
+        for(; i < nstarts; i++) {
+            if(fs.matchAt(begin + i)) return begin + i;
+        }
+        return nullptr;
+    }
+
+#endif
+
+    const char * FixedSearch::find(const char * begin, const char * end) const {
+        // Like regex_search with match_not_null, an empty pattern never
+        // matches.
+        if(pat.empty() || (size_t) (end - begin) < pat.size()) return nullptr;
+#ifdef BLTOOLS_X86
+        if(have_anchors) {
+            switch(simdLevel()) {
+            case SIMD_AVX2:
+                return findAvx2(*this, begin, end);
+            case SIMD_SSE2:
+                return findSse2(*this, begin, end);
+            default:
+                break;
+            }
+        }
+#endif
+        return findScalar(begin, end);
+    }
+}
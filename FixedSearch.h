@@ -0,0 +1,63 @@
+/*
+ * Vectorized search for a fixed pattern (blgrep -L).
+ *
+ * Two anchor positions of the pattern, normally its first and last, are
+ * compared against 16 (SSE2) or 32 (AVX2) text positions at once, and
+ * only the positions where both anchors agree are checked in full. The
+ * anchors can be small byte sets, so case-insensitive and IUPAC patterns
+ * go through the same filter. The instruction set is picked at run time;
+ * other CPUs and patterns with no usable anchor use a scalar loop.
+ *
+ */
+
+#ifndef BLTOOLS_FIXEDSEARCH_H
+#define BLTOOLS_FIXEDSEARCH_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <BytePattern.h>
+
+using std::string;
+using std::vector;
+
+namespace bltools {
+
+    class FixedSearch {
+
+        public:
+            // Largest anchor byte set the vector filter will compare
+            static const size_t MAX_ANCHOR_BYTES = 4;
+
+            explicit FixedSearch(const BytePattern &pattern);
+
+            // Start of the first match in [begin, end), or nullptr
+            const char * find(const char * begin, const char * end) const;
+            bool search(const char * begin, const char * end) const {
+                return find(begin, end) != nullptr;
+            }
+
+            // Full comparison of the pattern against text at p
+            bool matchAt(const char * p) const;
+
+            // Used by the per-instruction-set kernels
+            const BytePattern & pattern() const { return pat; }
+            size_t anchor(int i) const { return anchors[i]; }
+            const vector<unsigned char> & anchorBytes(int i) const {
+                return anchor_bytes[i];
+            }
+
+        private:
+            BytePattern pat;
+            bool exact;
+            string exact_bytes;
+            bool have_anchors;
+            size_t anchors[2];
+            vector<unsigned char> anchor_bytes[2];
+
+            const char * findScalar(const char * begin, const char * end) const;
+    };
+}
+
+#endif
@@ -0,0 +1,359 @@
+/*
+ * Threaded gzip and BGZF decompression; see GzipInput.h.
+ *
+ * Both kinds pass Blocks between threads through BoundedQueues, taking
+ * them from a fixed pool. For BGZF the reader numbers the blocks it
+ * takes from the pool, so the block underflow() needs next always has
+ * one, and a ReorderBuffer holds blocks that are inflated early until
+ * their turn. Problems found by the reader or a worker travel in the block
+ * itself, so they're reported in order too.
+ *
+ * Raw blocks carry compressed data for the single-stream inflater in
+ * underflow(): all of plain gzip, and whatever follows the first member
+ * of BGZF input that isn't a BGZF block. The workers pass those along
+ * untouched, so they keep their place in the order.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <zlib.h>
+
+#include <BoundedQueue.h>
+#include <GzipInput.h>
+#include <ReorderBuffer.h>
+
+using std::runtime_error;
+using std::string;
+using std::vector;
+
+namespace bltools {
+
+    // Compressed bytes read at a time from plain gzip
+    static const size_t CHUNK_SIZE = 1 << 20;
+    // Bytes inflated at a time from plain gzip
+    static const size_t OUT_SIZE = 1 << 18;
+    // Largest BGZF block, compressed or not
+    static const size_t BGZF_MAX = 1 << 16;
+    // Gzip header up to the length of the extra field
+    static const size_t HEADER_SIZE = 12;
+
+    namespace {
+        struct Block {
+            size_t number;
+            size_t data_offset;     // BGZF: start of the deflate data
+            bool raw;               // in is for the single-stream inflater
+            vector<char> in;
+            vector<char> out;
+            string error;
+        };
+
+        uint32_t readLE32(const char * p) {
+            const unsigned char * u = reinterpret_cast<const unsigned char *>(p);
+            return u[0] | (u[1] << 8) | (u[2] << 16) | (uint32_t(u[3]) << 24);
+        }
+    }
+
+    struct GzipStreambuf::State {
+        std::streambuf * source;
+        string prefix;              // Read from source to tell what it is
+        size_t prefix_used;
+        bool bgzf;
+
+        vector<Block> pool;
+        BoundedQueue<Block *> free_blocks;
+        BoundedQueue<Block *> todo;     // BGZF blocks to inflate
+        BoundedQueue<Block *> done;     // Inflated blocks or gzip chunks
+        vector<std::thread> threads;
+        std::atomic<unsigned> running;
+
+        ReorderBuffer<Block *> waiting;
+        Block * current;            // Being read from
+        string failed;
+
+        z_stream zs;                // For raw blocks
+        bool in_member;
+        bool zero_padded;           // Zeros seen after the last member
+        vector<char> output;
+
+        State(std::streambuf * source, size_t npool) :
+            source(source), prefix_used(0), bgzf(false), pool(npool),
+            free_blocks(npool), todo(npool), done(npool), running(0),
+            current(nullptr), in_member(false), zero_padded(false) {
+            for(Block &b: pool) free_blocks.push(&b);
+        }
+
+        // Up to n bytes of input, fewer only at the end
+        size_t read(char * p, size_t n) {
+            size_t got = 0;
+            if(prefix_used < prefix.size()) {
+                got = std::min(n, prefix.size() - prefix_used);
+                memcpy(p, prefix.data() + prefix_used, got);
+                prefix_used += got;
+            }
+            if(got < n) got += source->sgetn(p + got, n - got);
+            return got;
+        }
+
+        [[noreturn]] void fail(const string &why) {
+            failed = why;
+            throw runtime_error(why);
+        }
+
+        bool readBgzfBlock(Block &b);
+        void readBlocks();
+        void inflateBlocks();
+        void readChunks();
+        bool nextBlock();
+    };
+
+    // The next block of BGZF input into b.in; false at the end of the
+    // input. If the next member isn't a BGZF block, b.raw is set and
+    // b.in has as much of it as was read. Problems are left in b.error.
+    bool GzipStreambuf::State::readBgzfBlock(Block &b) {
+        b.in.resize(BGZF_MAX);
+        char * h = b.in.data();
+        size_t n = read(h, HEADER_SIZE);
+        if(n == 0) return false;
+        b.raw = true;
+        b.in.resize(n);
+        if(n < HEADER_SIZE ||
+           static_cast<unsigned char>(h[0]) != 0x1f ||
+           static_cast<unsigned char>(h[1]) != 0x8b || h[2] != 8 ||
+           (h[3] & 4) == 0) {
+            return true;
+        }
+        size_t xlen = static_cast<unsigned char>(h[10]) |
+            (static_cast<unsigned char>(h[11]) << 8);
+        if(HEADER_SIZE + xlen + 8 > BGZF_MAX) return true;
+        b.in.resize(HEADER_SIZE + xlen);
+        n = read(h + HEADER_SIZE, xlen);
+        if(n < xlen) {
+            b.in.resize(HEADER_SIZE + n);
+            return true;
+        }
+
+        // The BC subfield gives the block size
+        size_t block_size = 0;
+        const unsigned char * x = reinterpret_cast<const unsigned char *>(h + HEADER_SIZE);
+        for(size_t i = 0; i + 4 <= xlen; ) {
+            size_t slen = x[i + 2] | (x[i + 3] << 8);
+            if(x[i] == 'B' && x[i + 1] == 'C' && slen == 2 && i + 6 <= xlen) {
+                block_size = (x[i + 4] | (x[i + 5] << 8)) + 1;
+            }
+            i += 4 + slen;
+        }
+        b.data_offset = HEADER_SIZE + xlen;
+        if(block_size < b.data_offset + 8 || block_size > BGZF_MAX) return true;
+
+        b.raw = false;
+        b.in.resize(block_size);
+        size_t rest = block_size - b.data_offset;
+        if(read(h + b.data_offset, rest) < rest) {
+            b.error = "Truncated BGZF block";
+        }
+        return true;
+    }
+
+    // BGZF blocks until one isn't, then raw chunks of what's left
+    void GzipStreambuf::State::readBlocks() {
+        size_t number = 0;
+        bool raw = false;
+        Block * b;
+        while(free_blocks.pop(b)) {
+            b->number = number++;
+            b->error.clear();
+            b->raw = raw;
+            try {
+                if(raw) {
+                    b->in.resize(BGZF_MAX);
+                    b->in.resize(read(b->in.data(), BGZF_MAX));
+                    if(b->in.empty()) break;
+                } else if(!readBgzfBlock(*b)) {
+                    break;
+                }
+            } catch(std::exception const &e) {
+                b->error = e.what();
+            }
+            raw = b->raw;
+            todo.push(b);
+            if(!b->error.empty()) break;
+        }
+        todo.close();
+    }
+
+    void GzipStreambuf::State::inflateBlocks() {
+        z_stream z;
+        memset(&z, 0, sizeof(z));
+        inflateInit2(&z, -15);
+        char empty;
+        Block * b;
+        while(todo.pop(b)) {
+            if(b->error.empty() && !b->raw) {
+                const char * trailer = b->in.data() + b->in.size() - 8;
+                uint32_t crc = readLE32(trailer);
+                uint32_t size = readLE32(trailer + 4);
+                if(size > BGZF_MAX) {
+                    b->error = "Corrupt BGZF block";
+                } else {
+                    b->out.resize(size);
+                    inflateReset(&z);
+                    z.next_in = reinterpret_cast<Bytef *>(b->in.data() + b->data_offset);
+                    z.avail_in = trailer - (b->in.data() + b->data_offset);
+                    z.next_out = reinterpret_cast<Bytef *>(size > 0 ? b->out.data() : &empty);
+                    z.avail_out = size;
+                    if(inflate(&z, Z_FINISH) != Z_STREAM_END || z.avail_out != 0) {
+                        b->error = "Corrupt BGZF block";
+                    } else if(crc32(0, reinterpret_cast<const Bytef *>(b->out.data()),
+                                    size) != crc) {
+                        b->error = "BGZF block fails its CRC check";
+                    }
+                }
+            }
+            done.push(b);
+        }
+        inflateEnd(&z);
+        if(--running == 0) done.close();
+    }
+
+    void GzipStreambuf::State::readChunks() {
+        Block * b;
+        while(free_blocks.pop(b)) {
+            b->error.clear();
+            b->raw = true;
+            b->in.resize(CHUNK_SIZE);
+            size_t n = 0;
+            try {
+                n = read(b->in.data(), CHUNK_SIZE);
+            } catch(std::exception const &e) {
+                b->error = e.what();
+            }
+            b->in.resize(n);
+            if(n == 0 && b->error.empty()) break;
+            done.push(b);
+            if(!b->error.empty()) break;
+        }
+        done.close();
+    }
+
+    bool GzipStreambuf::looksCompressed(std::streambuf * source) {
+        return source->sgetc() == 0x1f;
+    }
+
+    GzipStreambuf::GzipStreambuf(std::streambuf * source, unsigned threads) {
+        if(threads == 0) threads = std::thread::hardware_concurrency();
+        if(threads == 0) threads = 1;
+
+        // BGZF has an extra field (FLG.FEXTRA) with a BC subfield
+        string p(16, '\0');
+        p.resize(source->sgetn(&p[0], p.size()));
+        bool bgzf = p.size() == 16 && (p[3] & 4) != 0 &&
+            p[12] == 'B' && p[13] == 'C' && p[14] == 2 && p[15] == 0;
+
+        // Plain gzip only needs a few chunks read ahead
+        state.reset(new State(source, bgzf ? 4 * threads + 4 : 4));
+        State &s = *state;
+        s.prefix = p;
+        s.bgzf = bgzf;
+
+        memset(&s.zs, 0, sizeof(s.zs));
+        inflateInit2(&s.zs, 15 + 16);
+        s.output.resize(OUT_SIZE);
+        if(s.bgzf) {
+            s.running = threads;
+            s.threads.emplace_back(&State::readBlocks, &s);
+            for(unsigned t = 0; t < threads; t++) {
+                s.threads.emplace_back(&State::inflateBlocks, &s);
+            }
+        } else {
+            s.threads.emplace_back(&State::readChunks, &s);
+        }
+    }
+
+    GzipStreambuf::~GzipStreambuf() {
+        State &s = *state;
+        s.free_blocks.close();
+        s.todo.close();
+        s.done.close();
+        for(std::thread &t: s.threads) t.join();
+        inflateEnd(&s.zs);
+    }
+
+    bool GzipStreambuf::isBgzf() const {
+        return state->bgzf;
+    }
+
+    // Move current on to the next block, in order; false at the end
+    bool GzipStreambuf::State::nextBlock() {
+        if(current != nullptr) {
+            free_blocks.push(current);
+            current = nullptr;
+        }
+        if(!bgzf) return done.pop(current);
+        while(!waiting.pop(current)) {
+            Block * b;
+            if(!done.pop(b)) return false;
+            waiting.add(b->number, b);
+        }
+        return true;
+    }
+
+    GzipStreambuf::int_type GzipStreambuf::underflow() {
+        State &s = *state;
+        if(gptr() < egptr()) return traits_type::to_int_type(*gptr());
+        if(!s.failed.empty()) throw runtime_error(s.failed);
+
+        for(;;) {
+            if(s.current == nullptr || !s.current->raw || s.zs.avail_in == 0) {
+                if(!s.nextBlock()) {
+                    if(!s.in_member) return traits_type::eof();
+                    s.fail("Unexpected end of gzip data");
+                }
+                Block * b = s.current;
+                if(!b->error.empty()) s.fail(b->error);
+                if(!b->raw) {
+                    if(b->out.empty()) continue;
+                    setg(b->out.data(), b->out.data(), b->out.data() + b->out.size());
+                    return traits_type::to_int_type(*gptr());
+                }
+                s.zs.next_in = reinterpret_cast<Bytef *>(b->in.data());
+                s.zs.avail_in = b->in.size();
+            }
+
+            // Members of concatenated gzip files follow each other, and
+            // zeros after the last one are padding, as zcat allows
+            if(!s.in_member) {
+                while(s.zs.avail_in > 0 && *s.zs.next_in == 0) {
+                    s.zs.next_in++;
+                    s.zs.avail_in--;
+                    s.zero_padded = true;
+                }
+                if(s.zs.avail_in == 0) continue;
+                if(s.zero_padded) s.fail("Unexpected data after gzip padding");
+                inflateReset(&s.zs);
+                s.in_member = true;
+            }
+            s.zs.next_out = reinterpret_cast<Bytef *>(s.output.data());
+            s.zs.avail_out = s.output.size();
+            int status = inflate(&s.zs, Z_NO_FLUSH);
+            if(status == Z_STREAM_END) {
+                s.in_member = false;
+            } else if(status != Z_OK && status != Z_BUF_ERROR) {
+                s.fail(string("Corrupt gzip data") +
+                       (s.zs.msg != nullptr ? string(": ") + s.zs.msg : string()));
+            }
+            size_t n = s.output.size() - s.zs.avail_out;
+            if(n > 0) {
+                setg(s.output.data(), s.output.data(), s.output.data() + n);
+                return traits_type::to_int_type(*gptr());
+            }
+        }
+    }
+}
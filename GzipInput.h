@@ -0,0 +1,62 @@
+/*
+ * Decompressing stream buffer for gzip and BGZF input.
+ *
+ * SeqFileInWrapper puts one of these between a compressed file (or
+ * stdin) and SeqAn's reader, so tools read .gz files directly instead
+ * of through zcat. Which kind of gzip it is comes from the first
+ * header: BGZF (as written by bgzip and samtools) has a 'BC' extra
+ * field giving the size of each block.
+ *
+ * BGZF blocks are independent, so a reader thread splits the input
+ * into blocks, a pool of threads inflates them, and underflow() hands
+ * them out in order. Plain gzip has to be inflated in one stream; a
+ * reader thread keeps the next compressed chunks ready while the
+ * calling thread inflates. Concatenated gzip members are read one after
+ * another, as zcat does: once a member of BGZF input turns out not to be
+ * a BGZF block, the rest is inflated as plain gzip. Zero bytes after the
+ * last member are taken as padding.
+ *
+ * A fixed number of blocks or chunks is in flight at a time, so memory
+ * doesn't depend on the size of the input. Corrupt or truncated input
+ * makes underflow() throw runtime_error once everything before the bad
+ * spot has been read.
+ *
+ */
+
+#ifndef BLTOOLS_GZIPINPUT_H
+#define BLTOOLS_GZIPINPUT_H
+
+#include <cstddef>
+#include <memory>
+#include <streambuf>
+#include <string>
+
+namespace bltools {
+
+    class GzipStreambuf : public std::streambuf {
+
+        private:
+            struct State;
+            std::unique_ptr<State> state;
+
+        protected:
+            int_type underflow() override;
+
+        public:
+            // Whether a stream starts like gzip, from its first byte
+            static bool looksCompressed(std::streambuf * source);
+
+            // Decompress from source, which must be at the start of the
+            // gzip data and outlive this. threads is how many inflate
+            // BGZF blocks; 0 for one per core.
+            explicit GzipStreambuf(std::streambuf * source, unsigned threads = 0);
+            ~GzipStreambuf();
+
+            GzipStreambuf(const GzipStreambuf &) = delete;
+            GzipStreambuf & operator=(const GzipStreambuf &) = delete;
+
+            bool isBgzf() const;
+    };
+}
+
+#endif
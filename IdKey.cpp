@@ -0,0 +1,45 @@
+/*
+ * Join and match keys from sequence IDs; see IdKey.h.
+ *
+ */
+
+#include <string>
+
+#include <IdKey.h>
+
+using std::string;
+
+namespace bltools {
+
+    IdKey::IdKey(unsigned field, const string &delim) : field(field) {
+        for(unsigned c = 0; c < 256; c++) is_delim[c] = false;
+        for(char c: delim) is_delim[static_cast<unsigned char>(c)] = true;
+    }
+
+    bool IdKey::extract(const StringRef &id, StringRef &key) const {
+        if(field == 0) {
+            key = id;
+            return true;
+        }
+        unsigned n = 0;
+        size_t start = 0;
+        bool delim_already_seen = false;
+        for(size_t i = 0; i < id.size; i++) {
+            if(is_delim[static_cast<unsigned char>(id[i])]) {
+                if(!delim_already_seen && ++n == field) {
+                    key = StringRef(id.data + start, i - start);
+                    return true;
+                }
+                delim_already_seen = true;
+            } else {
+                if(delim_already_seen) start = i;
+                delim_already_seen = false;
+            }
+        }
+        if(!delim_already_seen && ++n == field) {
+            key = StringRef(id.data + start, id.size - start);
+            return true;
+        }
+        return false;
+    }
+}
@@ -0,0 +1,58 @@
+/*
+ * The part of a sequence ID that records are matched on (bljoin -f/-d,
+ * blgrep -k/-d): the whole ID, or one field of it.
+ *
+ * Any character of the delimiter string separates fields, and a run of
+ * them counts as one. The field comes back as a StringRef into the ID,
+ * so nothing is copied or allocated per record. Ignoring case is left
+ * to IdTable, which folds keys as it hashes and compares them; the
+ * folding functions here are the ones it uses, for anything else that
+ * needs keys to come out the same way.
+ *
+ */
+
+#ifndef BLTOOLS_IDKEY_H
+#define BLTOOLS_IDKEY_H
+
+#include <cstdint>
+#include <string>
+
+#include <StringRef.h>
+
+using std::string;
+
+namespace bltools {
+
+    // ASCII upper case, as keys are folded when case is ignored
+    inline char foldCase(char c) {
+        return (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+    }
+
+    // foldCase() on each byte of a word
+    inline uint64_t foldCase(uint64_t w) {
+        const uint64_t ones = 0x0101010101010101ULL;
+        uint64_t low = w & (0x7f * ones);
+        uint64_t from_a = low + (0x80 - 'a') * ones;        // Top bit if >= 'a'
+        uint64_t past_z = low + (0x80 - 'z' - 1) * ones;    // Top bit if > 'z'
+        uint64_t lower = from_a & ~past_z & ~w & (0x80 * ones);
+        return w ^ (lower >> 2);
+    }
+
+    class IdKey {
+
+        private:
+            unsigned field;
+            bool is_delim[256];
+
+        public:
+            // field is 1-based; 0 for the whole ID
+            IdKey(unsigned field = 0, const string &delim = " ");
+
+            // Key of id, or false if id has fewer fields than asked for
+            bool extract(const StringRef &id, StringRef &key) const;
+
+            unsigned fieldNumber() const { return field; }
+    };
+}
+
+#endif
@@ -0,0 +1,125 @@
+/*
+ * Open-addressing ID table; see IdTable.h.
+ *
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <IdTable.h>
+
+using std::vector;
+
+namespace bltools {
+
+    IdTable::IdTable(bool fold_case) : mask(0), fold_case(fold_case) {}
+
+    uint64_t IdTable::hash(const StringRef &key, bool fold_case) {
+        const uint64_t m = 0x9e3779b97f4a7c15ULL;
+        uint64_t h = (key.size + 1) * m;
+        size_t i = 0;
+        uint64_t w;
+        for(; i + 8 <= key.size; i += 8) {
+            memcpy(&w, key.data + i, 8);
+            if(fold_case) w = foldCase(w);
+            h = (h ^ w) * m;
+            h ^= h >> 32;
+        }
+        w = 0;
+        if(i < key.size) memcpy(&w, key.data + i, key.size - i);
+        if(fold_case) w = foldCase(w);
+        h = (h ^ w) * m;
+        h ^= h >> 29;
+        h *= m;
+        h ^= h >> 32;
+        return h;
+    }
+
+    StringRef IdTable::slotKey(const char * key) {
+        uint32_t n;
+        memcpy(&n, key, sizeof(n));
+        return StringRef(key + sizeof(n), n);
+    }
+
+    // Whether a stored key is key, folded if the table ignores case
+    bool IdTable::matches(const char * slot_key, const StringRef &key) const {
+        StringRef stored = slotKey(slot_key);
+        if(!fold_case) return stored == key;
+        if(stored.size != key.size) return false;
+        size_t i = 0;
+        uint64_t a, b;
+        for(; i + 8 <= key.size; i += 8) {
+            memcpy(&a, stored.data + i, 8);
+            memcpy(&b, key.data + i, 8);
+            if(a != foldCase(b)) return false;
+        }
+        for(; i < key.size; i++) {
+            if(stored[i] != foldCase(key[i])) return false;
+        }
+        return true;
+    }
+
+    // Index of the slot holding key, or of the empty slot where it would go
+    size_t IdTable::probe(const StringRef &key, uint64_t h) const {
+        uint32_t tag = h;
+        size_t i = tag & mask;
+        while(slots[i].key != nullptr) {
+            if(slots[i].hash == tag && matches(slots[i].key, key)) {
+                return i;
+            }
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+
+    void IdTable::grow() {
+        size_t n = slots.empty() ? 1024 : slots.size() * 2;
+        vector<Slot> old;
+        old.swap(slots);
+        slots.assign(n, {nullptr, 0, 0});
+        mask = n - 1;
+        for(const Slot &s: old) {
+            if(s.key == nullptr) continue;
+            size_t i = s.hash & mask;
+            while(slots[i].key != nullptr) i = (i + 1) & mask;
+            slots[i] = s;
+        }
+    }
+
+    uint32_t IdTable::insert(const StringRef &key, bool &inserted) {
+
+        // Keep the load factor under 0.7
+        if((rows.size() + 1) * 10 > slots.size() * 7) grow();
+
+        uint64_t h = hash(key, fold_case);
+        size_t i = probe(key, h);
+        if(slots[i].key != nullptr) {
+            inserted = false;
+            return slots[i].row;
+        }
+
+        uint32_t n = key.size;
+        char * p = keys.alloc(sizeof(n) + n);
+        memcpy(p, &n, sizeof(n));
+        if(n > 0) memcpy(p + sizeof(n), key.data, n);
+        if(fold_case) {
+            for(uint32_t j = 0; j < n; j++) {
+                p[sizeof(n) + j] = foldCase(key[j]);
+            }
+        }
+
+        slots[i].key = p;
+        slots[i].hash = h;
+        slots[i].row = rows.size();
+        rows.push_back(p);
+        inserted = true;
+        return slots[i].row;
+    }
+
+    uint32_t IdTable::find(const StringRef &key) const {
+        if(slots.empty()) return NOT_FOUND;
+        size_t i = probe(key, hash(key, fold_case));
+        return slots[i].key == nullptr ? NOT_FOUND : slots[i].row;
+    }
+}
@@ -0,0 +1,76 @@
+/*
+ * Open-addressing hash table from sequence IDs to row numbers.
+ *
+ * Rows are handed out in insertion order starting at 0, so the table can
+ * be used as a set (blgrep -x) or as an index into per-ID arrays. Keys
+ * are copied once into an Arena; a slot is 16 bytes (key pointer, 32
+ * bits of hash, row), and lookups are a single linear probe sequence
+ * with no allocation.
+ *
+ * A table can ignore case: keys are then folded to upper case (see
+ * IdKey.h) a word at a time as they are hashed and compared, and stored
+ * folded, so lookups still work on IDs as they are read.
+ *
+ */
+
+#ifndef BLTOOLS_IDTABLE_H
+#define BLTOOLS_IDTABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <Arena.h>
+#include <IdKey.h>
+#include <StringRef.h>
+
+using std::vector;
+
+namespace bltools {
+
+    class IdTable {
+
+        private:
+            struct Slot {
+                const char * key;   // Length-prefixed copy in the arena
+                uint32_t hash;
+                uint32_t row;
+            };
+
+            vector<Slot> slots;
+            vector<const char *> rows;
+            Arena keys;
+            size_t mask;
+            bool fold_case;
+
+            static StringRef slotKey(const char * key);
+            void grow();
+            size_t probe(const StringRef &key, uint64_t h) const;
+            bool matches(const char * slot_key, const StringRef &key) const;
+
+        public:
+            static const uint32_t NOT_FOUND = 0xffffffff;
+
+            explicit IdTable(bool fold_case = false);
+
+            static uint64_t hash(const StringRef &key, bool fold_case = false);
+
+            // Row of key, adding it as a new row if it isn't there yet
+            uint32_t insert(const StringRef &key, bool &inserted);
+            uint32_t insert(const StringRef &key) {
+                bool inserted;
+                return insert(key, inserted);
+            }
+
+            // Row of key or NOT_FOUND
+            uint32_t find(const StringRef &key) const;
+
+            // As stored: folded if the table ignores case
+            StringRef key(uint32_t row) const { return slotKey(rows[row]); }
+            size_t size() const { return rows.size(); }
+            bool empty() const { return rows.empty(); }
+            bool foldsCase() const { return fold_case; }
+    };
+}
+
+#endif
@@ -0,0 +1,211 @@
+/*
+ * Arena-backed join rows with lazy padding; see JoinTable.h.
+ *
+ * At the end of file g every row should be targets[g] bytes long: the
+ * first-record lengths of files 0 to g plus a separator between each.
+ * A row that is shorter gets a separator (unless g is the first file)
+ * and then a pad string for each byte it is still short. padMissing()
+ * replays that for files a row wasn't in; once a row is exactly on
+ * target and the pad string is one byte, it stays on target, so the
+ * replay can skip straight to the end.
+ *
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <JoinTable.h>
+
+using std::string;
+using std::vector;
+
+namespace bltools {
+
+    // Bytes of padding written at a time
+    static const size_t PAD_BLOCK = 4096;
+
+    PadWriter::PadWriter(const string &pad) : pad(pad) {
+        if(!pad.empty()) {
+            while(block.size() + pad.size() <= PAD_BLOCK || block.empty()) {
+                block += pad;
+            }
+        }
+    }
+
+    void PadWriter::write(std::ostream &out, uint64_t times) const {
+        if(pad.empty()) return;
+        uint64_t per_block = block.size() / pad.size();
+        while(times >= per_block) {
+            out.write(block.data(), block.size());
+            times -= per_block;
+        }
+        out.write(block.data(), times * pad.size());
+    }
+
+    JoinTable::JoinTable(const string &pad, const string &separator,
+                         bool padding, bool fold_case) :
+        ids(fold_case), pad(pad), separator(separator), padding(padding),
+        total_bases(0), nfiles(0) {
+        length_sums.push_back(0);
+    }
+
+    uint32_t JoinTable::insert(const StringRef &id, bool &inserted) {
+        uint32_t row = ids.insert(id, inserted);
+        if(inserted) rows.push_back({nullptr, nullptr, 0, 0});
+        return row;
+    }
+
+    void JoinTable::noteLength(uint64_t length) {
+        lengths.push_back(length);
+        length_sums.push_back(length_sums.back() + length);
+    }
+
+    JoinTable::Segment * JoinTable::addSegment(uint32_t row, Segment::Kind kind) {
+        Segment * seg = reinterpret_cast<Segment *>(
+            data.alloc(sizeof(Segment), alignof(Segment)));
+        seg->kind = kind;
+        seg->first = 0;
+        seg->last = 0;
+        seg->data = nullptr;
+        seg->size = 0;
+        seg->next = nullptr;
+        Row &r = rows[row];
+        if(r.tail == nullptr) {
+            r.head = seg;
+        } else {
+            r.tail->next = seg;
+        }
+        r.tail = seg;
+        return seg;
+    }
+
+    // Length of a row after files first to last - 1, which it wasn't in,
+    // starting from length. The padding goes to out if there is one.
+    uint64_t JoinTable::padMissing(uint64_t length, uint32_t first,
+                                   uint32_t last, std::ostream * out) const {
+        for(uint32_t g = first; g < last; g++) {
+            if(out == nullptr && pad.size() == 1 && length == targets[g - 1]) {
+                return targets[last - 1];
+            }
+            uint64_t target = targets[g];
+            if(length >= target) continue;
+            if(g > 0) {
+                if(out != nullptr) *out << separator;
+                length += separator.size();
+            }
+            if(length < target) {
+                uint64_t n = target - length;
+                if(out != nullptr) pad.write(*out, n);
+                length += pad.size() * n;
+            }
+        }
+        return length;
+    }
+
+    void JoinTable::addRecord(uint32_t row, bool is_new, const StringRef &seq) {
+        Row &r = rows[row];
+        if(!is_new) {
+            if(padding && r.last_file < nfiles) {
+                Segment * seg = addSegment(row, Segment::MISSING);
+                seg->first = r.last_file;
+                seg->last = nfiles;
+                seg->size = r.length;
+                r.length = padMissing(r.length, r.last_file, nfiles, nullptr);
+            }
+            if(nfiles > 0) {
+                addSegment(row, Segment::SEPARATOR);
+                r.length += separator.size();
+            }
+        } else if(total_bases > 0 && padding) {
+            // A pad run and a separator for every length noted but the last
+            uint64_t k = lengths.size() - 1;
+            Segment * seg = addSegment(row, Segment::LEADING);
+            seg->size = k;
+            r.length += length_sums[k] * pad.size() + k * separator.size();
+        }
+
+        if(!seq.empty()) {
+            Segment * seg = addSegment(row, Segment::DATA);
+            char * p = data.alloc(seq.size);
+            memcpy(p, seq.data, seq.size);
+            seg->data = p;
+            seg->size = seq.size;
+            r.length += seq.size;
+        }
+
+        if(r.last_file != nfiles + 1) {
+            r.last_file = nfiles + 1;
+            in_file.push_back(row);
+        }
+    }
+
+    void JoinTable::endFile(uint64_t seq_size) {
+        total_bases += seq_size;
+        uint64_t target = total_bases + separator.size() * nfiles;
+        targets.push_back(target);
+
+        // Rows that weren't in this file are padded when they're next used
+        if(padding) {
+            for(uint32_t row: in_file) {
+                Row &r = rows[row];
+                if(r.length >= target) continue;
+                if(nfiles > 0) {
+                    addSegment(row, Segment::SEPARATOR);
+                    r.length += separator.size();
+                }
+                if(r.length < target) {
+                    Segment * seg = addSegment(row, Segment::PADDING);
+                    seg->size = target - r.length;
+                    r.length += pad.size() * seg->size;
+                }
+            }
+        }
+        in_file.clear();
+        nfiles++;
+    }
+
+    void JoinTable::write(std::ostream &out, uint32_t row) const {
+        const Row &r = rows[row];
+        for(const Segment * seg = r.head; seg != nullptr; seg = seg->next) {
+            switch(seg->kind) {
+            case Segment::DATA:
+                out.write(seg->data, seg->size);
+                break;
+            case Segment::SEPARATOR:
+                out << separator;
+                break;
+            case Segment::PADDING:
+                pad.write(out, seg->size);
+                break;
+            case Segment::LEADING:
+                for(uint64_t i = 0; i < seg->size; i++) {
+                    pad.write(out, lengths[i]);
+                    out << separator;
+                }
+                break;
+            case Segment::MISSING:
+                padMissing(seg->size, seg->first, seg->last, &out);
+                break;
+            }
+        }
+        if(padding && r.last_file < nfiles) {
+            padMissing(r.length, r.last_file, nfiles, &out);
+        }
+    }
+
+    vector<uint32_t> JoinTable::sortedRows() const {
+        vector<uint32_t> order(rows.size());
+        for(uint32_t i = 0; i < order.size(); i++) order[i] = i;
+        std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+            StringRef x = ids.key(a);
+            StringRef y = ids.key(b);
+            int c = memcmp(x.data, y.data, std::min(x.size, y.size));
+            return c != 0 ? c < 0 : x.size < y.size;
+        });
+        return order;
+    }
+}
@@ -0,0 +1,137 @@
+/*
+ * Joined sequences for bljoin, one row per join ID.
+ *
+ * IDs go into an IdTable, which gives each one a row number in order of
+ * first appearance. A row is a chain of segments allocated in an Arena:
+ * copies of the row's sequences, and markers for the separators and
+ * padding between them. Padding and separators are only spelled out as
+ * a row is written, so memory and time go with the sequence data, not
+ * with the padded size of the alignment.
+ *
+ * Files are read one at a time: addRecord() for each record, then
+ * endFile(). Rows missing from a file are not touched at all; the
+ * padding they would have been given is worked out when they next turn
+ * up, or when they are written. The result is byte for byte what
+ * bljoin's original padding gave, including its corner cases: a new row
+ * is padded for every length noted but the last, a row that comes up
+ * short at the end of a file gets a separator and then one pad string
+ * per missing byte (even when the pad string is longer than one byte),
+ * and a row that is too long is left alone until the others catch up.
+ *
+ */
+
+#ifndef BLTOOLS_JOINTABLE_H
+#define BLTOOLS_JOINTABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <Arena.h>
+#include <IdTable.h>
+#include <StringRef.h>
+
+using std::string;
+using std::vector;
+
+namespace bltools {
+
+    // A pad string, written any number of times in large writes
+    class PadWriter {
+
+        private:
+            string pad;
+            string block;               // pad, repeated
+
+        public:
+            explicit PadWriter(const string &pad);
+
+            // Bytes in one pad string
+            size_t size() const { return pad.size(); }
+            // times copies of the pad string
+            void write(std::ostream &out, uint64_t times) const;
+    };
+
+    class JoinTable {
+
+        private:
+            struct Segment {
+                enum Kind : uint8_t { DATA, SEPARATOR, PADDING, LEADING, MISSING };
+                Kind kind;
+                uint32_t first;         // MISSING: files first to last - 1
+                uint32_t last;
+                const char * data;      // DATA
+                uint64_t size;          // DATA: bytes; PADDING: pad strings;
+                                        // LEADING: lengths padded; MISSING:
+                                        // row length before the files
+                Segment * next;
+            };
+
+            struct Row {
+                Segment * head;
+                Segment * tail;
+                uint64_t length;        // Bytes, as of the end of last_file
+                uint32_t last_file;     // 1 + last file the row was in
+            };
+
+            IdTable ids;
+            vector<Row> rows;
+            Arena data;
+
+            PadWriter pad;
+            string separator;
+            bool padding;
+
+            vector<uint64_t> lengths;       // As noted
+            vector<uint64_t> length_sums;   // Of lengths before each
+            vector<uint64_t> targets;       // Padded length after each file
+            uint64_t total_bases;
+            uint32_t nfiles;
+            vector<uint32_t> in_file;       // Rows in the current file
+
+            Segment * addSegment(uint32_t row, Segment::Kind kind);
+            uint64_t padMissing(uint64_t length, uint32_t first, uint32_t last,
+                                std::ostream * out) const;
+
+        public:
+            static const uint32_t NOT_FOUND = IdTable::NOT_FOUND;
+
+            // Without padding rows just get a separator between files.
+            // With fold_case IDs match whatever their case, and are kept
+            // in upper case.
+            JoinTable(const string &pad, const string &separator, bool padding,
+                      bool fold_case = false);
+
+            // Row of id, or NOT_FOUND
+            uint32_t find(const StringRef &id) const { return ids.find(id); }
+            // Row of id, adding an empty row if it's new
+            uint32_t insert(const StringRef &id, bool &inserted);
+
+            // A file length that new rows will be padded for (once
+            // another length has been noted after it)
+            void noteLength(uint64_t length);
+
+            // Add a record's sequence to row; is_new as from insert()
+            void addRecord(uint32_t row, bool is_new, const StringRef &seq);
+            // seq_size is the length every row should have grown by
+            void endFile(uint64_t seq_size);
+
+            // Whether row has had a record from the file being read
+            bool inCurrentFile(uint32_t row) const {
+                return rows[row].last_file == nfiles + 1;
+            }
+
+            StringRef id(uint32_t row) const { return ids.key(row); }
+            size_t size() const { return rows.size(); }
+
+            // The row's joined sequence, padded to the end of the last file
+            void write(std::ostream &out, uint32_t row) const;
+
+            // Rows sorted by ID, bytewise like std::string
+            vector<uint32_t> sortedRows() const;
+    };
+}
+
+#endif
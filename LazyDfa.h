@@ -0,0 +1,661 @@
+/*
+ * Header-only POSIX ERE matcher built on a lazily constructed DFA.
+ *
+ * Patterns are parsed into a small syntax tree, compiled to a Thompson
+ * NFA (several patterns can share one NFA, which then matches if any of
+ * them does), and searched with a DFA whose states are only built as the
+ * text needs them. Each input byte costs one table lookup once its
+ * transition has been built and O(NFA size) the first time, so scanning
+ * is linear in the text no matter what the pattern is -- there is no
+ * backtracking and no recursion on the text, unlike std::regex.
+ *
+ * The syntax tree can be reversed and complemented (see BytePattern.h),
+ * so blgrep can search every strand of a sequence in the one pass over
+ * it by compiling all the variants into the same NFA.
+ *
+ * The DFA cache lives in the LazyDfa object, so keeping one LazyDfa
+ * around for a whole run means states built for one record are reused
+ * for the next. If the cache gets too big it is flushed and rebuilt.
+ * The compiled Nfa is immutable and can be shared between LazyDfa
+ * objects (e.g. one per thread).
+ *
+ * Supported syntax: literals, '.', bracket expressions with ranges,
+ * negation and [:class:] names, grouping, '|', '*', '+', '?', {m},
+ * {m,} and {m,n}, '^' and '$', and backslash escapes. Case-insensitive
+ * matching is done when compiling, by adding both cases to every set.
+ *
+ * Only "is there a match" is answered, with the same meaning as
+ * regex_search with match_not_null: the match must be non-empty.
+ *
+ */
+
+#ifndef BLTOOLS_LAZYDFA_H
+#define BLTOOLS_LAZYDFA_H
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <BytePattern.h>
+
+using std::string;
+using std::vector;
+
+namespace bltools {
+
+    // Syntax tree for one or more patterns
+    struct RegexTree {
+
+        enum Type { EMPTY, SET, CAT, ALT, STAR, PLUS, QUEST, BOL, EOL };
+
+        struct Node {
+            Type type;
+            int left;
+            int right;
+            int set;
+        };
+
+        vector<Node> nodes;
+        vector<ByteSet> sets;
+
+        int add(Type type, int left = -1, int right = -1, int set = -1) {
+            nodes.push_back({type, left, right, set});
+            return nodes.size() - 1;
+        }
+
+        int addSet(const ByteSet &s) {
+            sets.push_back(s);
+            return add(SET, -1, -1, sets.size() - 1);
+        }
+
+        int clone(int n) {
+            Node node = nodes[n];
+            int l = node.left >= 0 ? clone(node.left) : -1;
+            int r = node.right >= 0 ? clone(node.right) : -1;
+            return add(node.type, l, r, node.set);
+        }
+
+        // Copy of n that matches the reversed text: concatenations are
+        // swapped and '^' and '$' trade places.
+        int reversed(int n) {
+            Node node = nodes[n];
+            switch(node.type) {
+            case CAT:
+                {
+                    int r = reversed(node.right);
+                    return add(CAT, r, reversed(node.left));
+                }
+            case BOL:
+                return add(EOL);
+            case EOL:
+                return add(BOL);
+            default:
+                {
+                    int l = node.left >= 0 ? reversed(node.left) : -1;
+                    int r = node.right >= 0 ? reversed(node.right) : -1;
+                    return add(node.type, l, r, node.set);
+                }
+            }
+        }
+
+        // Copy of n that matches the complemented text
+        int complemented(int n) {
+            Node node = nodes[n];
+            if(node.type == SET) return addSet(sets[node.set].complemented());
+            int l = node.left >= 0 ? complemented(node.left) : -1;
+            int r = node.right >= 0 ? complemented(node.right) : -1;
+            return add(node.type, l, r, node.set);
+        }
+    };
+
+    // Recursive descent parser for the ERE subset described above
+    class RegexParser {
+
+        private:
+            RegexTree &tree;
+            const string &pat;
+            size_t pos;
+            bool icase;
+
+            static const int MAX_REPEAT = 1000;
+
+            [[noreturn]] void error(const string &msg) const {
+                throw std::runtime_error("Bad pattern '" + pat + "': " + msg);
+            }
+
+            bool atEnd() const { return pos >= pat.size(); }
+            char peek() const { return pat[pos]; }
+
+            ByteSet fold(const ByteSet &s) const {
+                if(!icase) return s;
+                ByteSet f = s;
+                for(int c = 0; c < 256; c++) {
+                    if(s.has(c)) {
+                        f.add(tolower(c));
+                        f.add(toupper(c));
+                    }
+                }
+                return f;
+            }
+
+            int literal(unsigned char c) {
+                ByteSet s;
+                s.add(c);
+                return tree.addSet(fold(s));
+            }
+
+            int parseAlt() {
+                int t = parseCat();
+                while(!atEnd() && peek() == '|') {
+                    pos++;
+                    t = tree.add(RegexTree::ALT, t, parseCat());
+                }
+                return t;
+            }
+
+            int parseCat() {
+                if(atEnd() || peek() == '|' || peek() == ')') {
+                    return tree.add(RegexTree::EMPTY);
+                }
+                int t = parseRepeat();
+                while(!atEnd() && peek() != '|' && peek() != ')') {
+                    t = tree.add(RegexTree::CAT, t, parseRepeat());
+                }
+                return t;
+            }
+
+            int parseNumber() {
+                int n = 0;
+                if(atEnd() || !isdigit(peek())) error("expected a number in {}");
+                while(!atEnd() && isdigit(peek())) {
+                    n = n * 10 + (pat[pos++] - '0');
+                    if(n > MAX_REPEAT) error("repeat count too large");
+                }
+                return n;
+            }
+
+            int repeat(int atom, int min, int max) {
+                // a{m,n} becomes m copies of a followed by nested optional
+                // copies: a a (a (a)?)?; max < 0 means no upper limit.
+                int t = -1;
+                for(int i = 0; i < min; i++) {
+                    int c = i == 0 ? atom : tree.clone(atom);
+                    t = t < 0 ? c : tree.add(RegexTree::CAT, t, c);
+                }
+                int tail = -1;
+                if(max < 0) {
+                    tail = tree.add(RegexTree::STAR, min == 0 ? atom : tree.clone(atom));
+                } else {
+                    for(int i = min; i < max; i++) {
+                        int c = (i == 0 && min == 0) ? atom : tree.clone(atom);
+                        tail = tail < 0 ? tree.add(RegexTree::QUEST, c) :
+                            tree.add(RegexTree::QUEST, tree.add(RegexTree::CAT, c, tail));
+                    }
+                }
+                if(t < 0 && tail < 0) return tree.add(RegexTree::EMPTY);
+                if(t < 0) return tail;
+                if(tail < 0) return t;
+                return tree.add(RegexTree::CAT, t, tail);
+            }
+
+            int parseRepeat() {
+                int t = parseAtom();
+                while(!atEnd()) {
+                    char c = peek();
+                    if(c == '*') {
+                        pos++;
+                        t = tree.add(RegexTree::STAR, t);
+                    } else if(c == '+') {
+                        pos++;
+                        t = tree.add(RegexTree::PLUS, t);
+                    } else if(c == '?') {
+                        pos++;
+                        t = tree.add(RegexTree::QUEST, t);
+                    } else if(c == '{' && pos + 1 < pat.size() && isdigit(pat[pos + 1])) {
+                        pos++;
+                        int min = parseNumber();
+                        int max = min;
+                        if(!atEnd() && peek() == ',') {
+                            pos++;
+                            max = (!atEnd() && peek() == '}') ? -1 : parseNumber();
+                        }
+                        if(atEnd() || peek() != '}') error("unterminated {}");
+                        pos++;
+                        if(max >= 0 && max < min) error("bad repeat range");
+                        t = repeat(t, min, max);
+                    } else {
+                        break;
+                    }
+                }
+                return t;
+            }
+
+            void addClass(ByteSet &s, const string &name) {
+                for(int c = 0; c < 128; c++) {
+                    bool in =
+                        name == "alpha" ? isalpha(c) :
+                        name == "digit" ? isdigit(c) :
+                        name == "alnum" ? isalnum(c) :
+                        name == "upper" ? isupper(c) :
+                        name == "lower" ? islower(c) :
+                        name == "space" ? isspace(c) :
+                        name == "blank" ? (c == ' ' || c == '\t') :
+                        name == "punct" ? ispunct(c) :
+                        name == "print" ? isprint(c) :
+                        name == "graph" ? isgraph(c) :
+                        name == "cntrl" ? iscntrl(c) :
+                        name == "xdigit" ? isxdigit(c) :
+                        (error("unknown class [:" + name + ":]"), false);
+                    if(in) s.add(c);
+                }
+            }
+
+            int parseBracket() {
+                ByteSet s;
+                bool negate = false;
+                if(!atEnd() && peek() == '^') {
+                    negate = true;
+                    pos++;
+                }
+                bool first = true;
+                while(true) {
+                    if(atEnd()) error("unterminated []");
+                    unsigned char c = pat[pos++];
+                    if(c == ']' && !first) break;
+                    first = false;
+                    if(c == '[' && !atEnd() &&
+                       (peek() == ':' || peek() == '=' || peek() == '.')) {
+                        char kind = pat[pos++];
+                        size_t close = pat.find(string(1, kind) + "]", pos);
+                        if(close == string::npos) error("unterminated [" + string(1, kind));
+                        string name = pat.substr(pos, close - pos);
+                        pos = close + 2;
+                        if(kind == ':') {
+                            addClass(s, name);
+                        } else {
+                            for(const char &n: name) s.add(n);
+                        }
+                        continue;
+                    }
+                    unsigned char hi = c;
+                    if(pos + 1 < pat.size() && peek() == '-' && pat[pos + 1] != ']') {
+                        hi = pat[pos + 1];
+                        pos += 2;
+                        if(hi < c) error("bad range in []");
+                    }
+                    for(int b = c; b <= hi; b++) s.add(b);
+                }
+                s = fold(s);
+                if(negate) {
+                    ByteSet n;
+                    for(int c = 1; c < 256; c++) if(!s.has(c)) n.add(c);
+                    s = n;
+                }
+                return tree.addSet(s);
+            }
+
+            int parseAtom() {
+                unsigned char c = pat[pos++];
+                switch(c) {
+                case '(':
+                    {
+                        int t = parseAlt();
+                        if(atEnd() || peek() != ')') error("unbalanced (");
+                        pos++;
+                        return t;
+                    }
+                case ')':
+                    error("unbalanced )");
+                case '[':
+                    return parseBracket();
+                case '.':
+                    {
+                        ByteSet s;
+                        for(int b = 1; b < 256; b++) s.add(b);
+                        return tree.addSet(s);
+                    }
+                case '^':
+                    return tree.add(RegexTree::BOL);
+                case '$':
+                    return tree.add(RegexTree::EOL);
+                case '\\':
+                    if(atEnd()) error("trailing backslash");
+                    return literal(pat[pos++]);
+                case '*': case '+': case '?':
+                    error(string("nothing to repeat before ") + (char) c);
+                default:
+                    return literal(c);
+                }
+            }
+
+        public:
+            RegexParser(RegexTree &tree, const string &pattern, bool icase) :
+                tree(tree), pat(pattern), pos(0), icase(icase) {}
+
+            int parse() {
+                int t = parseAlt();
+                if(!atEnd()) error("unbalanced )");
+                return t;
+            }
+    };
+
+    // Thompson NFA for the union of one or more patterns
+    class Nfa {
+
+        public:
+            enum Type { SET, SPLIT, BOL, EOL, MATCH };
+
+            struct State {
+                Type type;
+                int out;
+                int out1;
+                int set;
+            };
+
+            vector<State> states;
+            vector<ByteSet> sets;
+            int start;
+            int match;
+
+            // Bytes that no pattern can tell apart share a class, which
+            // keeps DFA transition tables small.
+            unsigned char byte_class[256];
+            unsigned nclasses;
+            vector<unsigned char> class_rep;
+
+            static std::shared_ptr<const Nfa> compile(const vector<string> &patterns,
+                                                      bool icase) {
+                RegexTree tree;
+                vector<int> roots;
+                for(const string &p: patterns) {
+                    RegexParser parser(tree, p, icase);
+                    roots.push_back(parser.parse());
+                }
+                return compile(tree, roots);
+            }
+
+            static std::shared_ptr<const Nfa> compile(const RegexTree &tree,
+                                                      const vector<int> &roots) {
+                std::shared_ptr<Nfa> nfa(new Nfa());
+                nfa->sets = tree.sets;
+                nfa->match = nfa->addState(MATCH, -1, -1, -1);
+                int start = -1;
+                for(const int &root: roots) {
+                    int entry = nfa->build(tree, root, nfa->match);
+                    start = start < 0 ? entry : nfa->addState(SPLIT, entry, start, -1);
+                }
+                // No patterns: a start that goes nowhere
+                nfa->start = start >= 0 ? start :
+                    nfa->addState(SPLIT, -1, -1, -1);
+                nfa->buildClasses();
+                return nfa;
+            }
+
+        private:
+            int addState(Type type, int out, int out1, int set) {
+                states.push_back({type, out, out1, set});
+                return states.size() - 1;
+            }
+
+            // States for node, leading on to next; returns the entry state
+            int build(const RegexTree &tree, int n, int next) {
+                const RegexTree::Node &node = tree.nodes[n];
+                switch(node.type) {
+                case RegexTree::EMPTY:
+                    return next;
+                case RegexTree::SET:
+                    return addState(SET, next, -1, node.set);
+                case RegexTree::CAT:
+                    return build(tree, node.left, build(tree, node.right, next));
+                case RegexTree::ALT:
+                    {
+                        int l = build(tree, node.left, next);
+                        int r = build(tree, node.right, next);
+                        return addState(SPLIT, l, r, -1);
+                    }
+                case RegexTree::QUEST:
+                    return addState(SPLIT, build(tree, node.left, next), next, -1);
+                case RegexTree::STAR:
+                    {
+                        int s = addState(SPLIT, -1, next, -1);
+                        int body = build(tree, node.left, s);
+                        states[s].out = body;
+                        return s;
+                    }
+                case RegexTree::PLUS:
+                    {
+                        int s = addState(SPLIT, -1, next, -1);
+                        int body = build(tree, node.left, s);
+                        states[s].out = body;
+                        return body;
+                    }
+                case RegexTree::BOL:
+                    return addState(BOL, next, -1, -1);
+                case RegexTree::EOL:
+                    return addState(EOL, next, -1, -1);
+                }
+                return next;
+            }
+
+            void buildClasses() {
+                // Refine a partition of the 256 byte values by each
+                // distinct set used in the NFA.
+                std::set<vector<uint64_t> > distinct;
+                for(const State &s: states) {
+                    if(s.type != SET) continue;
+                    const ByteSet &b = sets[s.set];
+                    distinct.insert(vector<uint64_t>(b.bits, b.bits + 4));
+                }
+                int cls[256];
+                for(int c = 0; c < 256; c++) cls[c] = 0;
+                int n = 1;
+                for(const vector<uint64_t> &bits: distinct) {
+                    if(n == 256) break;
+                    vector<int> renumber(2 * n, -1);
+                    int next = 0;
+                    for(int c = 0; c < 256; c++) {
+                        int in = (bits[c >> 6] >> (c & 63)) & 1;
+                        int key = cls[c] * 2 + in;
+                        if(renumber[key] < 0) renumber[key] = next++;
+                        cls[c] = renumber[key];
+                    }
+                    n = next;
+                }
+                nclasses = n;
+                class_rep.assign(n, 0);
+                for(int c = 255; c >= 0; c--) {
+                    byte_class[c] = cls[c];
+                    class_rep[cls[c]] = c;
+                }
+            }
+    };
+
+    class LazyDfa {
+
+        private:
+            std::shared_ptr<const Nfa> nfa;
+
+            // Transition table, nclasses entries per state: the next
+            // state shifted left one bit, with the low bit set if taking
+            // the transition completes a match. UNKNOWN if not built yet.
+            enum : int32_t { UNKNOWN = -1 };
+            vector<int32_t> trans;
+
+            // A DFA state is the set of NFA states (byte-consuming and
+            // '$' states only) reached by the text so far, plus whether
+            // nothing has been read yet. Only text actually consumed is
+            // in the set; new match attempts (the unanchored search) are
+            // added when a transition is built, which keeps empty matches
+            // from ever being reported.
+            vector<vector<int> > state_sets;
+            vector<char> state_begin;
+            vector<signed char> end_accept;
+            std::unordered_map<string, int32_t> state_ids;
+            size_t max_states;
+            int32_t dead;
+
+            vector<int> inj;            // Start closure, not at the beginning
+            vector<int> inj_begin;      // Start closure at the beginning
+
+            // Scratch space
+            vector<unsigned> mark;
+            unsigned generation;
+            vector<int> stack;
+            vector<int> seeds;
+            vector<int> next_set;
+            string key;
+
+            // Add the closure of seeds to out (sorted); returns true if
+            // the match state is reached. '^' is only passed at the
+            // beginning and '$' only at the end of the text.
+            bool closure(const vector<int> &from, bool at_begin, bool at_end,
+                         vector<int> &out) {
+                out.clear();
+                if(++generation == 0) {
+                    std::fill(mark.begin(), mark.end(), 0);
+                    generation = 1;
+                }
+                bool matched = false;
+                stack.clear();
+                for(const int &s: from) if(s >= 0) stack.push_back(s);
+                while(!stack.empty()) {
+                    int s = stack.back();
+                    stack.pop_back();
+                    if(mark[s] == generation) continue;
+                    mark[s] = generation;
+                    const Nfa::State &st = nfa->states[s];
+                    switch(st.type) {
+                    case Nfa::SET:
+                        out.push_back(s);
+                        break;
+                    case Nfa::SPLIT:
+                        if(st.out >= 0) stack.push_back(st.out);
+                        if(st.out1 >= 0) stack.push_back(st.out1);
+                        break;
+                    case Nfa::BOL:
+                        if(at_begin) stack.push_back(st.out);
+                        break;
+                    case Nfa::EOL:
+                        if(at_end) {
+                            stack.push_back(st.out);
+                        } else {
+                            out.push_back(s);
+                        }
+                        break;
+                    case Nfa::MATCH:
+                        matched = true;
+                        break;
+                    }
+                }
+                std::sort(out.begin(), out.end());
+                return matched;
+            }
+
+            int32_t addState(const vector<int> &set, bool begin) {
+                key.assign(1, begin ? 1 : 0);
+                key.append(reinterpret_cast<const char *>(set.data()),
+                           set.size() * sizeof(int));
+                auto it = state_ids.find(key);
+                if(it != state_ids.end()) return it->second;
+
+                if(state_sets.size() >= max_states) {
+                    // Too many states: start the cache over. Callers must
+                    // not touch ids they got before this.
+                    reset();
+                    return addState(set, begin);
+                }
+
+                int32_t id = state_sets.size();
+                state_ids[key] = id;
+                state_sets.push_back(set);
+                state_begin.push_back(begin);
+                end_accept.push_back(-1);
+                trans.resize(trans.size() + nfa->nclasses, UNKNOWN);
+                if(!begin && set.empty() && inj.empty()) dead = id;
+                return id;
+            }
+
+            void reset() {
+                trans.clear();
+                state_sets.clear();
+                state_begin.clear();
+                end_accept.clear();
+                state_ids.clear();
+                dead = -1;
+                addState(vector<int>(), true);      // State 0: nothing read
+            }
+
+            int32_t buildTransition(int32_t d, unsigned cls) {
+                unsigned char rep = nfa->class_rep[cls];
+                seeds.clear();
+                const vector<int> &injected = state_begin[d] ? inj_begin : inj;
+                const vector<int> *sources[] = {&state_sets[d], &injected};
+                for(const vector<int> *v: sources) {
+                    for(const int &s: *v) {
+                        const Nfa::State &st = nfa->states[s];
+                        if(st.type == Nfa::SET && nfa->sets[st.set].has(rep)) {
+                            seeds.push_back(st.out);
+                        }
+                    }
+                }
+                bool accept = closure(seeds, false, false, next_set);
+                size_t before = state_sets.size();
+                int32_t next = addState(next_set, false);
+                int32_t t = (next << 1) | (accept ? 1 : 0);
+                // Only cache if the table wasn't flushed under us
+                if(state_sets.size() >= before) {
+                    trans[(size_t) d * nfa->nclasses + cls] = t;
+                }
+                return t;
+            }
+
+            bool endAccept(int32_t d) {
+                if(end_accept[d] < 0) {
+                    seeds.clear();
+                    for(const int &s: state_sets[d]) {
+                        if(nfa->states[s].type == Nfa::EOL) seeds.push_back(s);
+                    }
+                    end_accept[d] = closure(seeds, false, true, next_set);
+                }
+                return end_accept[d];
+            }
+
+        public:
+            explicit LazyDfa(std::shared_ptr<const Nfa> nfa,
+                             size_t max_bytes = 64 << 20) :
+                nfa(nfa), dead(-1), mark(nfa->states.size(), 0), generation(0) {
+                max_states = max_bytes / (nfa->nclasses * sizeof(int32_t));
+                if(max_states < 64) max_states = 64;
+                vector<int> start(1, nfa->start);
+                closure(start, false, false, inj);
+                closure(start, true, false, inj_begin);
+                reset();
+            }
+
+            // Does any pattern have a non-empty match in [begin, end)?
+            bool search(const char * begin, const char * end) {
+                const unsigned nc = nfa->nclasses;
+                int32_t d = 0;
+                for(const char * p = begin; p != end; p++) {
+                    unsigned cls = nfa->byte_class[(unsigned char) *p];
+                    int32_t t = trans[(size_t) d * nc + cls];
+                    if(t == UNKNOWN) t = buildTransition(d, cls);
+                    if(t & 1) return true;
+                    d = t >> 1;
+                    if(d == dead) return false;
+                }
+                return endAccept(d);
+            }
+
+            size_t cachedStates() const { return state_sets.size(); }
+    };
+}
+
+#endif
@@ -0,0 +1,406 @@
+/*
+ * Zero-copy FASTA/FASTQ reader for regular files; see MappedSeqFile.h.
+ *
+ * Parsing is line based and uses memchr to find line ends. FASTQ
+ * records are parsed structurally (sequence lines up to the '+' line,
+ * then quality lines until there is as much quality as sequence), so a
+ * quality line starting with '@' is never mistaken for a header.
+ *
+ */
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <MappedSeqFile.h>
+
+using std::runtime_error;
+using std::string;
+
+namespace bltools {
+
+    // Bytes prefetched at a time when scanning backwards
+    static const size_t TAIL_BLOCK = 1 << 20;
+
+    MappedSeqFile::MappedSeqFile() :
+        fd(-1), base(nullptr), len(0), pos(0), fmt(0) {}
+
+    MappedSeqFile::~MappedSeqFile() {
+        close();
+    }
+
+    bool MappedSeqFile::open(const string &path) {
+
+        close();
+        if(path == "-") return false;
+
+        fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0) return false;
+
+        struct stat st;
+        if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+            close();
+            return false;
+        }
+
+        void * m = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(m == MAP_FAILED) {
+            close();
+            return false;
+        }
+        base = static_cast<const char *>(m);
+        len = st.st_size;
+        madvise(m, len, MADV_SEQUENTIAL);
+
+        // Only take over files that are recognizably fasta or fastq;
+        // everything else is left to SeqAn.
+        pos = 0;
+        skipBlankLines();
+        if(pos >= len || (base[pos] != '>' && base[pos] != '@')) {
+            close();
+            return false;
+        }
+        fmt = base[pos];
+        return true;
+    }
+
+    void MappedSeqFile::close() {
+        if(base != nullptr) {
+            munmap(const_cast<char *>(base), len);
+        }
+        if(fd >= 0) {
+            ::close(fd);
+        }
+        fd = -1;
+        base = nullptr;
+        len = 0;
+        pos = 0;
+        fmt = 0;
+    }
+
+    bool MappedSeqFile::atEnd() {
+        skipBlankLines();
+        return pos >= len;
+    }
+
+    size_t MappedSeqFile::lineEnd(size_t from) const {
+        const void * nl = memchr(base + from, '\n', len - from);
+        if(nl == nullptr) return len;
+        return static_cast<const char *>(nl) - base;
+    }
+
+    // Line contents between from and eol, without a trailing '\r'
+    StringRef MappedSeqFile::line(size_t from, size_t eol) const {
+        size_t n = eol - from;
+        if(n > 0 && base[eol - 1] == '\r') n--;
+        return StringRef(base + from, n);
+    }
+
+    size_t MappedSeqFile::nextLine(size_t eol) const {
+        return eol < len ? eol + 1 : len;
+    }
+
+    void MappedSeqFile::skipBlankLines() {
+        while(pos < len && (base[pos] == '\n' || base[pos] == '\r')) pos++;
+    }
+
+    // SeqAn's reader drops all whitespace inside sequence and quality
+    // lines, so lines holding any are copied without it. Bytes up to
+    // ' ' are looked for first, which the compiler can vectorize; only
+    // lines with one are checked character by character.
+    static bool maybeSpaced(const StringRef &l) {
+        bool low = false;
+        for(size_t i = 0; i < l.size; i++) {
+            low |= (unsigned char) l.data[i] <= ' ';
+        }
+        return low;
+    }
+
+    static bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    // Append l to buf without whitespace; returns the number appended
+    static size_t appendUnspaced(string &buf, const StringRef &l) {
+        if(!maybeSpaced(l)) {
+            buf.append(l.data, l.size);
+            return l.size;
+        }
+        size_t n = 0;
+        for(char c: l) {
+            if(isSpace(c)) continue;
+            buf += c;
+            n++;
+        }
+        return n;
+    }
+
+    static size_t unspacedSize(const StringRef &l) {
+        if(!maybeSpaced(l)) return l.size;
+        size_t n = 0;
+        for(char c: l) n += !isSpace(c);
+        return n;
+    }
+
+    bool MappedSeqFile::readRecord(RecordView &rec) {
+
+        skipBlankLines();
+        if(pos >= len) return false;
+
+        if(base[pos] != fmt) {
+            throw runtime_error("Record does not start with '" +
+                                string(1, fmt) + "'");
+        }
+        rec.offset = pos;
+
+        size_t eol = lineEnd(pos);
+        rec.id = line(pos + 1, eol);
+        pos = nextLine(eol);
+
+        // Sequence lines: up to the next header for fasta, up to the '+'
+        // line for fastq. Views point into the mapping unless the
+        // sequence is wrapped or has whitespace in it.
+        char stop = fmt == '>' ? '>' : '+';
+        unsigned nlines = 0;
+        bool copied = false;
+        StringRef first;
+        while(pos < len && base[pos] != stop) {
+            eol = lineEnd(pos);
+            StringRef l = line(pos, eol);
+            pos = nextLine(eol);
+            if(l.empty()) continue;
+            if(nlines == 0 && !maybeSpaced(l)) {
+                first = l;
+            } else {
+                if(!copied) seq_buf.assign(first.data, first.size);
+                copied = true;
+                appendUnspaced(seq_buf, l);
+            }
+            nlines++;
+        }
+        rec.seq = copied ? StringRef(seq_buf) : first;
+        rec.qual = StringRef();
+
+        if(fmt == '@') {
+            if(pos >= len) {
+                throw runtime_error("Unexpected end of file in fastq record");
+            }
+            pos = nextLine(lineEnd(pos));   // '+' line
+
+            nlines = 0;
+            copied = false;
+            first = StringRef();
+            size_t qlen = 0;
+            while(pos < len && qlen < rec.seq.size) {
+                eol = lineEnd(pos);
+                StringRef l = line(pos, eol);
+                pos = nextLine(eol);
+                if(nlines == 0 && !maybeSpaced(l)) {
+                    first = l;
+                    qlen += l.size;
+                } else {
+                    if(!copied) qual_buf.assign(first.data, first.size);
+                    copied = true;
+                    qlen += appendUnspaced(qual_buf, l);
+                }
+                nlines++;
+            }
+            rec.qual = copied ? StringRef(qual_buf) : first;
+            if(rec.qual.size != rec.seq.size) {
+                throw runtime_error("Quality and sequence lengths differ for " +
+                                    rec.id.str());
+            }
+        }
+
+        rec.length = pos - rec.offset;
+        return true;
+    }
+
+    bool MappedSeqFile::skipRecord(LazyRecord &rec) {
+
+        skipBlankLines();
+        if(pos >= len) return false;
+
+        if(base[pos] != fmt) {
+            throw runtime_error("Record does not start with '" +
+                                string(1, fmt) + "'");
+        }
+        rec.offset = pos;
+
+        size_t eol = lineEnd(pos);
+        rec.id = line(pos + 1, eol);
+        pos = nextLine(eol);
+
+        if(fmt == '>') {
+            // The next '>' at the start of a line; a '>' anywhere else in
+            // the sequence is just skipped over.
+            while(pos < len && base[pos] != '>') {
+                const void * gt = memchr(base + pos, '>', len - pos);
+                if(gt == nullptr) {
+                    pos = len;
+                    break;
+                }
+                size_t g = static_cast<const char *>(gt) - base;
+                pos = base[g - 1] == '\n' ? g : g + 1;
+            }
+        } else {
+            // Fastq needs the sequence length to know where the quality
+            // ends, but only line lengths are looked at.
+            size_t slen = 0;
+            while(pos < len && base[pos] != '+') {
+                eol = lineEnd(pos);
+                slen += unspacedSize(line(pos, eol));
+                pos = nextLine(eol);
+            }
+            if(pos >= len) {
+                throw runtime_error("Unexpected end of file in fastq record");
+            }
+            pos = nextLine(lineEnd(pos));   // '+' line
+            size_t qlen = 0;
+            while(pos < len && qlen < slen) {
+                eol = lineEnd(pos);
+                qlen += unspacedSize(line(pos, eol));
+                pos = nextLine(eol);
+            }
+            if(qlen != slen) {
+                throw runtime_error("Quality and sequence lengths differ for " +
+                                    rec.id.str());
+            }
+        }
+
+        rec.length = pos - rec.offset;
+        return true;
+    }
+
+    void MappedSeqFile::readRecordAt(size_t offset, RecordView &rec) {
+        size_t saved = pos;
+        pos = offset;
+        bool ok = readRecord(rec);
+        pos = saved;
+        if(!ok) throw runtime_error("No record at offset " + std::to_string(offset));
+    }
+
+    // A line starting with '@' in a fastq file is either a header or a
+    // quality line. For four-line records a header is followed by a
+    // sequence line, a '+' line and a quality line of the same length as
+    // the sequence. A quality line is followed by the next header (or
+    // nothing). Anything else means wrapped records, which can't be told
+    // apart reading backwards.
+    bool MappedSeqFile::isFastqHeader(size_t start, bool &ambiguous) const {
+
+        ambiguous = false;
+        size_t starts[4];
+        size_t ends[4];
+        size_t p = start;
+        unsigned n = 0;
+        for(; n < 4 && p < len; n++) {
+            starts[n] = p;
+            ends[n] = lineEnd(p);
+            p = nextLine(ends[n]);
+        }
+
+        if(n < 2 || base[starts[1]] == '@') return false;
+        if(n == 4 && base[starts[2]] == '+' &&
+           line(starts[1], ends[1]).size == line(starts[3], ends[3]).size) {
+            return true;
+        }
+        ambiguous = true;
+        return false;
+    }
+
+    bool MappedSeqFile::findTail(size_t n, size_t &offset) const {
+
+        offset = 0;
+        if(n == 0) {
+            offset = len;
+            return true;
+        }
+
+        size_t found = 0;
+        size_t p = len;
+        size_t block_start = len;
+        while(p > 0) {
+
+            if(p <= block_start) {
+                // Ask for the previous block before walking through it
+                block_start = p > TAIL_BLOCK ? p - TAIL_BLOCK : 0;
+                size_t page = sysconf(_SC_PAGESIZE);
+                size_t aligned = block_start - block_start % page;
+                madvise(const_cast<char *>(base) + aligned, p - aligned,
+                        MADV_WILLNEED);
+            }
+
+            // Line start: just after the previous '\n', or the file start
+            const void * nl = memrchr(base, '\n', p - 1);
+            size_t start = nl == nullptr ? 0 :
+                static_cast<const char *>(nl) - base + 1;
+
+            if(start < len && base[start] == fmt) {
+                bool is_record = true;
+                if(fmt == '@') {
+                    bool ambiguous;
+                    is_record = isFastqHeader(start, ambiguous);
+                    if(ambiguous) return false;
+                }
+                if(is_record && ++found == n) {
+                    offset = start;
+                    return true;
+                }
+            }
+            p = start;
+        }
+
+        // Fewer than n records: start from the beginning
+        return true;
+    }
+
+    bool MappedSeqFile::findRecordStart(size_t from, size_t &offset) const {
+
+        offset = len;
+        if(from == 0) {
+            offset = 0;
+            return true;
+        }
+
+        // First line start at or after from
+        size_t p = from;
+        if(p < len && base[p - 1] != '\n') p = nextLine(lineEnd(p));
+
+        while(p < len) {
+            if(base[p] == fmt) {
+                if(fmt == '>') {
+                    offset = p;
+                    return true;
+                }
+                // A quality line can start with '@' too. Four line
+                // records must also be followed by another header.
+                bool ambiguous;
+                if(isFastqHeader(p, ambiguous)) {
+                    size_t next = p;
+                    for(int i = 0; i < 4; i++) next = nextLine(lineEnd(next));
+                    if(next >= len || base[next] == fmt) {
+                        offset = p;
+                        return true;
+                    }
+                    ambiguous = true;
+                }
+                if(ambiguous) return false;
+            }
+            if(fmt == '>') {
+                // Headers are only looked for at line starts
+                const void * gt = memchr(base + p, '>', len - p);
+                if(gt == nullptr) return true;
+                size_t g = static_cast<const char *>(gt) - base;
+                p = base[g - 1] == '\n' ? g : nextLine(lineEnd(g));
+            } else {
+                p = nextLine(lineEnd(p));
+            }
+        }
+        return true;
+    }
+}
@@ -0,0 +1,109 @@
+/*
+ * Zero-copy FASTA/FASTQ reader for regular files.
+ *
+ * The whole file is mmap'ed and each record comes back as a RecordView
+ * whose fields point into the mapping. For single-line records (the
+ * usual case for FASTQ and for most modern FASTA) nothing is copied at
+ * all. Wrapped FASTA sequence lines and wrapped FASTQ quality lines are
+ * joined into a scratch buffer owned by the reader, which is reused for
+ * every record, so views are only valid until the next call to
+ * readRecord. Lines with spaces or tabs in them go through the buffer
+ * too, without the whitespace, as they would with SeqAn's reader.
+ *
+ * open() refuses anything it can't map or doesn't recognize as FASTA or
+ * FASTQ (stdin, pipes, empty files, genbank, ...); SeqFileInWrapper
+ * falls back to SeqAn's stream reader for those.
+ *
+ * skipRecord() is the lazy version of readRecord() for callers that
+ * mostly need only the ID (name searches, record counts): it reads the
+ * header line and skips the rest of the record without parsing it,
+ * using memchr to find the next header in fasta. The full record can be
+ * read later with readRecordAt() if it turns out to be wanted.
+ *
+ * findTail() lets bltail start near the end of a file: only the blocks
+ * holding the last few records are ever paged in.
+ *
+ */
+
+#ifndef BLTOOLS_MAPPEDSEQFILE_H
+#define BLTOOLS_MAPPEDSEQFILE_H
+
+#include <cstddef>
+#include <string>
+
+#include <StringRef.h>
+
+using std::string;
+
+namespace bltools {
+
+    struct RecordView {
+        StringRef id;        // Header line without the leading '>' or '@'
+        StringRef seq;       // Sequence with line breaks removed
+        StringRef qual;      // Quality string; empty for fasta
+        size_t offset;       // Byte offset of the '>' or '@'
+        size_t length;       // Bytes from offset to the start of the next record
+    };
+
+    // A record whose header has been read but not its sequence or
+    // quality; see MappedSeqFile::skipRecord.
+    struct LazyRecord {
+        StringRef id;
+        size_t offset;       // Byte offset of the '>' or '@'
+        size_t length;       // Bytes from offset to the start of the next record
+    };
+
+    class MappedSeqFile {
+
+        private:
+            int fd;
+            const char * base;
+            size_t len;
+            size_t pos;
+            char fmt;
+            string seq_buf;
+            string qual_buf;
+
+            size_t lineEnd(size_t from) const;
+            StringRef line(size_t from, size_t eol) const;
+            size_t nextLine(size_t eol) const;
+            void skipBlankLines();
+            bool isFastqHeader(size_t start, bool &ambiguous) const;
+
+        public:
+            MappedSeqFile();
+            ~MappedSeqFile();
+            MappedSeqFile(const MappedSeqFile &) = delete;
+            MappedSeqFile & operator=(const MappedSeqFile &) = delete;
+
+            bool open(const string &path);
+            void close();
+            bool isOpen() const { return base != nullptr; }
+            bool atEnd();
+            bool readRecord(RecordView &rec);
+            bool skipRecord(LazyRecord &rec);
+            // Read the record at offset without moving the read position
+            void readRecordAt(size_t offset, RecordView &rec);
+
+            // '>' for fasta, '@' for fastq
+            char format() const { return fmt; }
+            const char * data() const { return base; }
+            size_t size() const { return len; }
+            size_t tell() const { return pos; }
+            void seek(size_t offset) { pos = offset < len ? offset : len; }
+
+            // Scan backwards from the end of the file, a block at a time,
+            // for the start of the n'th record from the end. Returns false
+            // if that can't be decided without a forward parse (wrapped
+            // fastq).
+            bool findTail(size_t n, size_t &offset) const;
+
+            // Start of the first record at or after byte from (the file
+            // size if there is none), for splitting a file into pieces
+            // that can be read separately. Returns false if that can't
+            // be decided without parsing from the start (wrapped fastq).
+            bool findRecordStart(size_t from, size_t &offset) const;
+    };
+}
+
+#endif
@@ -0,0 +1,200 @@
+/*
+ * k-way merge join of sorted files; see MergeJoin.h.
+ *
+ * A row is written file by file. Where the row has records its
+ * sequences go out as they are read (with a separator before each one
+ * unless it starts the row or is in the first file), and after every
+ * file from the row's first on the row is padded to that file's target
+ * length the way JoinTable::endFile() does it. A row that starts after
+ * the first file is led by a pad run and a separator for each earlier
+ * file with records, as long as there were any bases before it.
+ *
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <MergeJoin.h>
+
+using std::endl;
+using std::runtime_error;
+using std::string;
+using std::vector;
+
+namespace bltools {
+
+    MergeJoin::MergeJoin(const string &pad, const string &separator,
+                         bool padding, bool allow_dups, const IdKey &id_key,
+                         bool fold_case) :
+        pad(pad), separator(separator), padding(padding),
+        allow_dups(allow_dups), id_key(id_key), fold_case(fold_case) {
+    }
+
+    // Move in on to its next record with a join ID, checking the order
+    void MergeJoin::advance(Input &in, std::ostream &err) {
+        string &previous = in.last_key;
+        previous.swap(in.key);
+        bool had_key = in.has_key;
+        for(;;) {
+            if(in.handle.atEnd()) {
+                in.done = true;
+                return;
+            }
+            in.handle.readRecord(in.rec);
+
+            if(in.seq_size == 0) {
+                if(padding && in.rec.seq.empty()) {
+                    throw runtime_error("The first record of " + in.name +
+                                        " is empty, so there is no length to pad to");
+                }
+                in.seq_size = in.rec.seq.size;
+            }
+            if(in.seq_size != in.rec.seq.size) {
+                err << "Warning " << in.rec.id << " is not the same size as other seqs"
+                    << " in the same file " << in.seq_size << " " <<
+                    in.rec.seq.size << endl;
+            }
+
+            StringRef key;
+            if(!id_key.extract(in.rec.id, key)) continue;
+            in.key.assign(key.data, key.size);
+            if(fold_case) {
+                for(char &c: in.key) c = foldCase(c);
+            }
+            in.has_key = true;
+            if(!had_key) return;
+
+            int c = in.key.compare(previous);
+            if(c < 0) {
+                throw runtime_error(in.name + " is not sorted by ID: " + in.key +
+                                    " comes after " + previous);
+            }
+            if(c == 0 && !allow_dups) {
+                err << in.key << " found more than once in " << in.name << endl;
+                throw runtime_error("Duplicated ID");
+            }
+            return;
+        }
+    }
+
+    // Join the records with ID key from the files in present, which are
+    // in order; each of them is left at its next ID.
+    void MergeJoin::writeRow(const string &key, const vector<size_t> &present,
+                             std::ostream &out, std::ostream &err) {
+        out << '>' << key << '\n';
+        uint64_t length = 0;
+        bool started = false;
+        size_t next = 0;
+        for(size_t g = 0; g < inputs.size(); g++) {
+            if(next < present.size() && present[next] == g) {
+                next++;
+                Input &in = *inputs[g];
+                bool starts_row = !started;
+                if(starts_row && padding && length_sums[g] > 0) {
+                    for(size_t h = 0; h < g; h++) {
+                        if(lengths[h] == 0) continue;
+                        pad.write(out, lengths[h]);
+                        out << separator;
+                        length += lengths[h] * pad.size() + separator.size();
+                    }
+                }
+                started = true;
+                do {
+                    if(!starts_row && g > 0) {
+                        out << separator;
+                        length += separator.size();
+                    }
+                    starts_row = false;
+                    out << in.rec.seq;
+                    length += in.rec.seq.size;
+                    advance(in, err);
+                } while(!in.done && in.key == key);
+            }
+
+            if(!started || !padding) continue;
+            uint64_t target = targets[g];
+            if(length >= target) continue;
+            if(g > 0) {
+                out << separator;
+                length += separator.size();
+            }
+            if(length < target) {
+                pad.write(out, target - length);
+                length += pad.size() * (target - length);
+            }
+        }
+        out << '\n';
+    }
+
+    void MergeJoin::run(vector<string> &files, std::ostream &out, std::ostream &err) {
+        inputs.clear();
+        lengths.clear();
+        length_sums.assign(1, 0);
+        targets.clear();
+
+        for(string &file: files) {
+            std::unique_ptr<Input> in(new Input());
+            in->name = file;
+            try {
+                in->handle.open(file);
+            } catch(...) {
+                throw runtime_error("Could not open " + file);
+            }
+            in->done = false;
+            in->has_key = false;
+            in->seq_size = 0;
+            advance(*in, err);
+            inputs.push_back(std::move(in));
+        }
+
+        // Every file's length is known once its first record is read
+        for(size_t g = 0; g < inputs.size(); g++) {
+            lengths.push_back(inputs[g]->seq_size);
+            length_sums.push_back(length_sums.back() + lengths[g]);
+            targets.push_back(length_sums.back() + separator.size() * g);
+        }
+
+        // Files by their next ID, then by position
+        auto later = [this](size_t a, size_t b) {
+            int c = inputs[a]->key.compare(inputs[b]->key);
+            return c != 0 ? c > 0 : a > b;
+        };
+        vector<size_t> heap;
+        for(size_t g = 0; g < inputs.size(); g++) {
+            if(!inputs[g]->done) heap.push_back(g);
+        }
+        std::make_heap(heap.begin(), heap.end(), later);
+
+        string key;
+        vector<size_t> present;
+        while(!heap.empty()) {
+            key = inputs[heap.front()]->key;
+            present.clear();
+            while(!heap.empty() && inputs[heap.front()]->key == key) {
+                std::pop_heap(heap.begin(), heap.end(), later);
+                present.push_back(heap.back());
+                heap.pop_back();
+            }
+            std::sort(present.begin(), present.end());
+
+            writeRow(key, present, out, err);
+
+            for(size_t g: present) {
+                if(inputs[g]->done) continue;
+                heap.push_back(g);
+                std::push_heap(heap.begin(), heap.end(), later);
+            }
+        }
+
+        for(std::unique_ptr<Input> &in: inputs) {
+            if(!in->handle.close()) {
+                throw runtime_error("Problem closing " + in->name);
+            }
+        }
+        inputs.clear();
+    }
+}
@@ -0,0 +1,78 @@
+/*
+ * Streaming join of files that are already sorted by join ID (bljoin -S).
+ *
+ * Every file is opened at once and the next record of each is kept in
+ * a heap ordered by ID. The smallest ID is joined across the files that
+ * have it and written straight away, so memory goes with the number of
+ * files rather than with the size of the joined alignment.
+ *
+ * IDs must be in byte order, as `LC_ALL=C sort' leaves them, and the
+ * output is the same as bljoin without -S given the same files. A
+ * file's padding length is the length of its first record, as long as
+ * that isn't empty; the padding follows the same rule as JoinTable,
+ * worked out one row at a time.
+ *
+ */
+
+#ifndef BLTOOLS_MERGEJOIN_H
+#define BLTOOLS_MERGEJOIN_H
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <IdKey.h>
+#include <JoinTable.h>
+#include <SeqFileInWrapper.h>
+#include <StringRef.h>
+
+using std::string;
+using std::vector;
+
+namespace bltools {
+
+    class MergeJoin {
+
+        private:
+            struct Input {
+                SeqFileInWrapper handle;
+                string name;
+                RecordView rec;
+                string key;
+                string last_key;        // Buffer swapped with key
+                bool done;              // No records left
+                bool has_key;           // key is set
+                uint64_t seq_size;      // Length of the first record
+            };
+
+            vector<std::unique_ptr<Input> > inputs;
+            vector<uint64_t> lengths;       // Padding length of each file
+            vector<uint64_t> length_sums;   // Of lengths before each
+            vector<uint64_t> targets;       // Padded row length after each
+
+            PadWriter pad;
+            string separator;
+            bool padding;
+            bool allow_dups;
+            IdKey id_key;
+            bool fold_case;
+
+            void advance(Input &in, std::ostream &err);
+            void writeRow(const string &key, const vector<size_t> &present,
+                          std::ostream &out, std::ostream &err);
+
+        public:
+            // IDs are matched on id_key, in upper case with fold_case
+            MergeJoin(const string &pad, const string &separator, bool padding,
+                      bool allow_dups, const IdKey &id_key, bool fold_case);
+
+            // Join files into fasta on out, with warnings on err. Throws
+            // runtime_error if a file can't be opened or read, isn't
+            // sorted, or (without allow_dups) has an ID twice.
+            void run(vector<string> &files, std::ostream &out, std::ostream &err);
+    };
+}
+
+#endif
@@ -0,0 +1,268 @@
+/*
+ * Aho-Corasick automaton plus lazy DFA fallback; see MultiPattern.h.
+ *
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <MultiPattern.h>
+
+using std::deque;
+using std::string;
+using std::vector;
+
+namespace bltools {
+
+    AhoCorasick::AhoCorasick(bool icase, bool complement) : npatterns(0) {
+        trie.push_back({-1, -1, 0, false});
+        for(int c = 0; c < 256; c++) {
+            fold[c] = icase ? tolower(c) : c;
+            root_next[c] = 0;
+        }
+        for(int c = 0; c < 256; c++) {
+            text_map[c] = complement ? fold[(unsigned char) complementBase(c)] : fold[c];
+        }
+    }
+
+    void AhoCorasick::add(const string &pattern) {
+        if(pattern.empty()) return;     // Never a non-empty match
+        int32_t s = 0;
+        for(const char &ch: pattern) {
+            unsigned char c = fold[(unsigned char) ch];
+            int32_t t = trie[s].first_child;
+            while(t >= 0 && trie[t].byte != c) t = trie[t].next_sibling;
+            if(t < 0) {
+                t = trie.size();
+                trie.push_back({-1, trie[s].first_child, c, false});
+                trie[s].first_child = t;
+            }
+            s = t;
+        }
+        trie[s].terminal = true;
+        npatterns++;
+    }
+
+    int32_t AhoCorasick::child(int32_t s, unsigned char c) const {
+        if(s == 0) return root_next[c];
+        uint32_t lo = edge_start[s];
+        uint32_t hi = edge_start[s + 1];
+        if(hi - lo <= 8) {
+            for(uint32_t i = lo; i < hi; i++) {
+                if(edge_bytes[i] == c) return edge_targets[i];
+            }
+            return -1;
+        }
+        while(lo < hi) {
+            uint32_t mid = (lo + hi) / 2;
+            if(edge_bytes[mid] < c) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo < edge_start[s + 1] && edge_bytes[lo] == c ?
+            edge_targets[lo] : -1;
+    }
+
+    void AhoCorasick::compile() {
+
+        size_t nnodes = trie.size();
+        fail.assign(nnodes, 0);
+        output.assign(nnodes, false);
+        edge_start.assign(nnodes + 1, 0);
+        edge_bytes.clear();
+        edge_targets.clear();
+
+        // Flatten child lists into sorted edge arrays
+        for(size_t s = 0; s < nnodes; s++) {
+            edge_start[s] = edge_bytes.size();
+            vector<std::pair<unsigned char, int32_t> > kids;
+            for(int32_t t = trie[s].first_child; t >= 0; t = trie[t].next_sibling) {
+                kids.push_back({trie[t].byte, t});
+            }
+            std::sort(kids.begin(), kids.end());
+            for(auto &k: kids) {
+                edge_bytes.push_back(k.first);
+                edge_targets.push_back(k.second);
+            }
+            output[s] = trie[s].terminal;
+        }
+        edge_start[nnodes] = edge_bytes.size();
+        for(int c = 0; c < 256; c++) root_next[c] = 0;
+        for(uint32_t i = edge_start[0]; i < edge_start[1]; i++) {
+            root_next[edge_bytes[i]] = edge_targets[i];
+        }
+
+        // Failure links, breadth first
+        deque<int32_t> queue;
+        for(uint32_t i = edge_start[0]; i < edge_start[1]; i++) {
+            fail[edge_targets[i]] = 0;
+            queue.push_back(edge_targets[i]);
+        }
+        while(!queue.empty()) {
+            int32_t u = queue.front();
+            queue.pop_front();
+            for(uint32_t i = edge_start[u]; i < edge_start[u + 1]; i++) {
+                unsigned char c = edge_bytes[i];
+                int32_t v = edge_targets[i];
+                int32_t f = fail[u];
+                int32_t t;
+                while((t = child(f, c)) < 0) f = fail[f];
+                fail[v] = t;
+                output[v] = output[v] || output[t];
+                queue.push_back(v);
+            }
+        }
+
+        vector<TrieNode>().swap(trie);
+    }
+
+    bool AhoCorasick::search(const char * begin, const char * end) const {
+        if(npatterns == 0) return false;
+        int32_t s = 0;
+        for(const char * p = begin; p != end; p++) {
+            unsigned char c = text_map[(unsigned char) *p];
+            int32_t t;
+            while((t = child(s, c)) < 0) s = fail[s];
+            s = t;
+            if(output[s]) return true;
+        }
+        return false;
+    }
+
+    bool isLiteralPattern(const string &pattern, string &literal) {
+        static const char * special = ".[]()*+?{}|^$";
+        literal.clear();
+        for(size_t i = 0; i < pattern.size(); i++) {
+            char c = pattern[i];
+            if(c == '\\') {
+                if(i + 1 < pattern.size() && strchr(special, pattern[i + 1]) != nullptr) {
+                    literal += pattern[++i];
+                    continue;
+                }
+                return false;
+            }
+            if(strchr(special, c) != nullptr) return false;
+            literal += c;
+        }
+        return true;
+    }
+
+    MultiPattern::MultiPattern(bool icase, bool fixed, bool iupac,
+                               unsigned max_errors) :
+        all_fixed(fixed || iupac || max_errors > 0), iupac(iupac), icase(icase),
+        max_errors(max_errors) {}
+
+    MultiPattern::MultiPattern(const MultiPattern &other) :
+        plain(other.plain), iupac_patterns(other.iupac_patterns),
+        regexes(other.regexes), fixed(other.fixed), approx(other.approx),
+        literals(other.literals), comp_literals(other.comp_literals),
+        nfa(other.nfa), all_fixed(other.all_fixed), iupac(other.iupac),
+        icase(other.icase), max_errors(other.max_errors) {
+        if(nfa) dfa.reset(new LazyDfa(nfa));
+    }
+
+    void MultiPattern::add(const string &pattern) {
+        string literal;
+        if(iupac) {
+            iupac_patterns.push_back(pattern);
+        } else if(all_fixed) {
+            plain.push_back(pattern);
+        } else if(isLiteralPattern(pattern, literal)) {
+            plain.push_back(literal);
+        } else {
+            regexes.push_back(pattern);
+        }
+    }
+
+    void MultiPattern::compile(unsigned strands) {
+
+        fixed.clear();
+        approx.clear();
+        literals.reset();
+        comp_literals.reset();
+        nfa.reset();
+        dfa.reset();
+
+        // Fixed and approximate patterns: the pattern for each strand is
+        // searched for separately.
+        vector<BytePattern> byte_patterns;
+        for(const string &p: iupac_patterns) {
+            byte_patterns.push_back(BytePattern::iupac(p, icase));
+        }
+        if(plain.size() == 1 || max_errors > 0) {
+            for(const string &p: plain) {
+                byte_patterns.push_back(BytePattern::literal(p, icase));
+            }
+        }
+        for(const BytePattern &bp: byte_patterns) {
+            vector<BytePattern> variants;
+            if(strands & STRAND_FORWARD) variants.push_back(bp);
+            if(strands & STRAND_REVERSE) variants.push_back(bp.reversed());
+            if(strands & STRAND_COMPLEMENT) variants.push_back(bp.complemented());
+            if(strands & STRAND_REVCOMP) {
+                variants.push_back(bp.reversed().complemented());
+            }
+            for(const BytePattern &v: variants) {
+                if(max_errors > 0) {
+                    approx.push_back(ApproxSearch(v, max_errors));
+                } else {
+                    fixed.push_back(FixedSearch(v));
+                }
+            }
+        }
+
+        // Plain strings: reversing one gives another plain string, but
+        // complementing one doesn't (N stands for many bytes), so the
+        // complement strands get an automaton that complements the text.
+        literals.reset(new AhoCorasick(icase));
+        comp_literals.reset(new AhoCorasick(icase, true));
+        if(plain.size() > 1 && max_errors == 0) {
+            for(const string &p: plain) {
+                string r(p.rbegin(), p.rend());
+                if(strands & STRAND_FORWARD) literals->add(p);
+                if(strands & STRAND_REVERSE) literals->add(r);
+                if(strands & STRAND_COMPLEMENT) comp_literals->add(p);
+                if(strands & STRAND_REVCOMP) comp_literals->add(r);
+            }
+        }
+        literals->compile();
+        comp_literals->compile();
+
+        // Regexes, and the variants of them for each strand, all go into
+        // one NFA.
+        if(!regexes.empty() && strands != 0) {
+            RegexTree tree;
+            vector<int> roots;
+            for(const string &p: regexes) {
+                RegexParser parser(tree, p, icase);
+                int root = parser.parse();
+                if(strands & STRAND_FORWARD) roots.push_back(root);
+                if(strands & STRAND_REVERSE) roots.push_back(tree.reversed(root));
+                if(strands & STRAND_COMPLEMENT) roots.push_back(tree.complemented(root));
+                if(strands & STRAND_REVCOMP) {
+                    roots.push_back(tree.complemented(tree.reversed(root)));
+                }
+            }
+            nfa = Nfa::compile(tree, roots);
+            dfa.reset(new LazyDfa(nfa));
+        }
+    }
+
+    bool MultiPattern::search(const char * begin, const char * end) {
+        for(const FixedSearch &fs: fixed) {
+            if(fs.search(begin, end)) return true;
+        }
+        for(ApproxSearch &as: approx) {
+            if(as.search(begin, end)) return true;
+        }
+        if(literals && literals->search(begin, end)) return true;
+        if(comp_literals && comp_literals->search(begin, end)) return true;
+        return dfa && dfa->search(begin, end);
+    }
+}
@@ -0,0 +1,140 @@
+/*
+ * Matching many patterns at once, for blgrep -f.
+ *
+ * Patterns that are plain strings (no ERE operators, or only escaped
+ * ones) are compiled together into a single Aho-Corasick automaton, so
+ * each record is scanned once no matter how many of them there are.
+ * Patterns that really are regexes are compiled together into one lazy
+ * DFA (LazyDfa.h), which is tried after the automaton; its state cache
+ * is kept from one record to the next.
+ *
+ * A single plain string goes to FixedSearch instead of the automaton, as
+ * do IUPAC patterns. With fixed set, every pattern is taken as a plain
+ * string (blgrep -L). With max_errors above 0, every pattern is a plain
+ * or IUPAC string matched with up to that many edits by ApproxSearch
+ * (blgrep -e).
+ *
+ * compile() can also set the patterns up to search the reverse,
+ * complement and reverse complement strands of a sequence (blgrep -M)
+ * without copying it: regexes and fixed patterns are reversed and/or
+ * complemented and added alongside the originals, and complemented
+ * plain strings go to a second automaton that complements the text as
+ * it reads it.
+ *
+ * Only "does anything match" is reported, which is all blgrep needs.
+ * As with regex_search and match_not_null, an empty pattern never
+ * matches. search() isn't const because it grows the DFA cache; a copy
+ * of a compiled MultiPattern shares the automata but has its own cache,
+ * so give each thread its own copy.
+ *
+ */
+
+#ifndef BLTOOLS_MULTIPATTERN_H
+#define BLTOOLS_MULTIPATTERN_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <ApproxSearch.h>
+#include <FixedSearch.h>
+#include <LazyDfa.h>
+
+using std::string;
+using std::vector;
+
+namespace bltools {
+
+    class AhoCorasick {
+
+        private:
+            // Trie while patterns are being added
+            struct TrieNode {
+                int32_t first_child;
+                int32_t next_sibling;
+                unsigned char byte;
+                bool terminal;
+            };
+            vector<TrieNode> trie;
+
+            // Compiled automaton; edges are stored per node, sorted by
+            // byte, with a dense table for the root.
+            vector<int32_t> fail;
+            vector<bool> output;
+            vector<uint32_t> edge_start;
+            vector<unsigned char> edge_bytes;
+            vector<int32_t> edge_targets;
+            int32_t root_next[256];
+            unsigned char fold[256];
+            unsigned char text_map[256];
+            size_t npatterns;
+
+            int32_t child(int32_t s, unsigned char c) const;
+
+        public:
+            // With icase, patterns and text are both folded to lower case.
+            // With complement, the text is complemented (complementBase)
+            // before it is compared.
+            explicit AhoCorasick(bool icase = false, bool complement = false);
+
+            void add(const string &pattern);
+            void compile();
+            bool search(const char * begin, const char * end) const;
+
+            size_t size() const { return npatterns; }
+            bool empty() const { return npatterns == 0; }
+    };
+
+    // If pattern has no ERE operators (after removing escapes), put the
+    // string it matches in literal and return true.
+    bool isLiteralPattern(const string &pattern, string &literal);
+
+    // Strands for MultiPattern::compile()
+    enum {
+        STRAND_FORWARD = 1,
+        STRAND_REVERSE = 2,
+        STRAND_COMPLEMENT = 4,
+        STRAND_REVCOMP = 8
+    };
+
+    class MultiPattern {
+
+        private:
+            // Patterns as added, sorted by kind; compile() builds the
+            // matchers below from them
+            vector<string> plain;
+            vector<string> iupac_patterns;
+            vector<string> regexes;
+
+            vector<FixedSearch> fixed;
+            vector<ApproxSearch> approx;
+            std::shared_ptr<AhoCorasick> literals;
+            std::shared_ptr<AhoCorasick> comp_literals;
+            std::shared_ptr<const Nfa> nfa;
+            std::unique_ptr<LazyDfa> dfa;
+            bool all_fixed;
+            bool iupac;
+            bool icase;
+            unsigned max_errors;
+
+        public:
+            explicit MultiPattern(bool icase, bool fixed = false, bool iupac = false,
+                                  unsigned max_errors = 0);
+            MultiPattern(const MultiPattern &other);
+            MultiPattern & operator=(const MultiPattern &) = delete;
+
+            void add(const string &pattern);
+            // strands is a combination of the STRAND_ flags. Throws
+            // runtime_error if a regex is malformed.
+            void compile(unsigned strands = STRAND_FORWARD);
+            bool search(const char * begin, const char * end);
+
+            size_t literalCount() const {
+                return plain.size() + iupac_patterns.size();
+            }
+            size_t regexCount() const { return regexes.size(); }
+    };
+}
+
+#endif
@@ -0,0 +1,72 @@
+/*
+ * Fixed-capacity ring buffer of record positions.
+ *
+ * bltail and blhead -n -N only need to remember where the last N records
+ * are, not what is in them: with a mapped input the records can be read
+ * again from their offsets when it's time to print them. Each slot is 16
+ * bytes no matter how long the record is. Storage grows as records are
+ * pushed, so a large N on a small file doesn't allocate N slots up front.
+ *
+ */
+
+#ifndef BLTOOLS_RECORDRING_H
+#define BLTOOLS_RECORDRING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using std::vector;
+
+namespace bltools {
+
+    struct RecordSpan {
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    class RecordRing {
+
+        private:
+            vector<RecordSpan> slots;
+            size_t capacity;
+            size_t head;        // Oldest entry once the ring is full
+
+        public:
+            explicit RecordRing(size_t capacity) :
+                capacity(capacity), head(0) {}
+
+            // Add a record. Once the ring is full, the oldest record is
+            // dropped and returned through evicted, and push returns true.
+            bool push(const RecordSpan &span, RecordSpan &evicted) {
+                if(capacity == 0) {
+                    evicted = span;
+                    return true;
+                }
+                if(slots.size() < capacity) {
+                    slots.push_back(span);
+                    return false;
+                }
+                evicted = slots[head];
+                slots[head] = span;
+                head = (head + 1) % capacity;
+                return true;
+            }
+
+            bool push(const RecordSpan &span) {
+                RecordSpan evicted;
+                return push(span, evicted);
+            }
+
+            // Oldest first
+            const RecordSpan & operator[](size_t i) const {
+                return slots[(head + i) % slots.size()];
+            }
+
+            size_t size() const { return slots.size(); }
+            bool empty() const { return slots.empty(); }
+            void clear() { slots.clear(); head = 0; }
+    };
+}
+
+#endif
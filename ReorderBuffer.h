@@ -0,0 +1,49 @@
+/*
+ * Putting numbered work back in order. Items numbered 0, 1, 2, ...
+ * come back from worker threads in whatever order they finish; add()
+ * each one as it arrives, and pop() hands them out in number order,
+ * holding on to those that arrived before their turn.
+ *
+ * Only the thread that puts things back in order should use it, so it
+ * has no locking of its own.
+ *
+ */
+
+#ifndef BLTOOLS_REORDERBUFFER_H
+#define BLTOOLS_REORDERBUFFER_H
+
+#include <cstddef>
+#include <map>
+#include <utility>
+
+namespace bltools {
+
+    template <typename T>
+    class ReorderBuffer {
+
+        private:
+            std::map<size_t, T> waiting;
+            size_t number;
+
+        public:
+            ReorderBuffer() : number(0) {}
+
+            void add(size_t n, T item) {
+                waiting.emplace(n, std::move(item));
+            }
+
+            // The next item in order, if it has arrived
+            bool pop(T &item) {
+                if(waiting.empty() || waiting.begin()->first != number) return false;
+                item = std::move(waiting.begin()->second);
+                waiting.erase(waiting.begin());
+                number++;
+                return true;
+            }
+
+            // Number of the next item pop() will give
+            size_t next() const { return number; }
+    };
+}
+
+#endif
@@ -11,13 +11,21 @@
  *
  * Note that Seqan is supposed to be able to handle gzipped files,
  * but only is SEQAN_HAS_ZLIB is defined as 1 and it is compiled
- * with zlib support. This seems to be a somewhat sketchy feature.
+ * with zlib support. This seems to be a somewhat sketchy feature, so
+ * compressed input (a file or stdin starting with the gzip magic
+ * number) is decompressed here instead, by a GzipStreambuf in front of
+ * SeqFileIn: BGZF on decompress_threads threads, plain gzip with the
+ * reading done on a thread of its own. Compressed input is never
+ * mapped, so it can't be indexed or seeked in.
  *
  */
 
+#include <algorithm>
+#include <stdexcept>
 #include <string>
 #include <iostream>
 #include <seqan/seq_io.h>
+#include <MappedSeqFile.h>
 #include <SeqFileInWrapper.h>
 
 using std::string;
@@ -37,14 +45,28 @@ namespace bltools {
 
         bool file_ok = false;
 
+        filename = infile;
+        index.clear();
+        if(allow_mmap && mapped.open(infile)) {
+            return;
+        }
+
         if(infile == "-") {
             input_stream = &cin;
             file_ok = true;
         } else {
-            input.open(infile.c_str(), ifstream::in);
+            input.open(infile.c_str(), ifstream::in | ifstream::binary);
             file_ok = input.is_open() && input.good();
             input_stream = &input;
         }
+        if(file_ok && GzipStreambuf::looksCompressed(input_stream->rdbuf())) {
+            gzip_buf.reset(new GzipStreambuf(input_stream->rdbuf(),
+                                             decompress_threads));
+            gzip_stream.reset(new istream(gzip_buf.get()));
+            // Let decompression errors through rather than looking like EOF
+            gzip_stream->exceptions(istream::badbit);
+            input_stream = gzip_stream.get();
+        }
         file_ok &= seqan::open(sqh, *input_stream);
         if(!file_ok) {
             throw "problem opening file";
@@ -52,12 +74,160 @@ namespace bltools {
     }
 
     bool SeqFileInWrapper::close() {
+        index.clear();
+        if(mapped.isOpen()) {
+            mapped.close();
+            return true;
+        }
         bool close_ok = seqan::close(sqh);
+        gzip_stream.reset();
+        gzip_buf.reset();
+        input_error.clear();
         input.close();
         return close_ok;
     }
 
+    void SeqFileInWrapper::checkInput() const {
+        if(!input_error.empty()) throw std::runtime_error(input_error);
+    }
+
     bool SeqFileInWrapper::atEnd() {
+        if(mapped.isOpen()) {
+            return mapped.atEnd();
+        }
+        if(gzip_buf) {
+            // Tools only catch errors from reading records, so a
+            // decompression error is kept for the next readRecord
+            try {
+                return seqan::atEnd(sqh);
+            } catch(std::exception const &e) {
+                input_error = e.what();
+                return false;
+            }
+        }
         return seqan::atEnd(sqh);
     }
+
+    bool SeqFileInWrapper::isMapped() const {
+        return mapped.isOpen();
+    }
+
+    void SeqFileInWrapper::readRecord(RecordView &rec) {
+        if(mapped.isOpen()) {
+            if(!mapped.readRecord(rec)) {
+                throw std::runtime_error("Unexpected end of file");
+            }
+            return;
+        }
+        checkInput();
+        seqan::readRecord(id_buf, seq_buf, qual_buf, sqh);
+        rec.id = StringRef(begin(id_buf, Standard()), length(id_buf));
+        rec.seq = StringRef(begin(seq_buf, Standard()), length(seq_buf));
+        rec.qual = StringRef(begin(qual_buf, Standard()), length(qual_buf));
+        rec.offset = 0;
+        rec.length = 0;
+    }
+
+    void SeqFileInWrapper::readRecord(LazyRecord &rec) {
+        if(mapped.isOpen()) {
+            if(!mapped.skipRecord(rec)) {
+                throw std::runtime_error("Unexpected end of file");
+            }
+            return;
+        }
+        readRecord(lazy_view);
+        rec.id = lazy_view.id;
+        rec.offset = 0;
+        rec.length = 0;
+    }
+
+    void SeqFileInWrapper::decode(const LazyRecord &rec, RecordView &view) {
+        if(mapped.isOpen()) {
+            mapped.readRecordAt(rec.offset, view);
+        } else {
+            view = lazy_view;
+        }
+    }
+
+    void SeqFileInWrapper::readRecord(CharString &id, CharString &seq,
+                                      CharString &qual) {
+        if(mapped.isOpen()) {
+            RecordView rec;
+            readRecord(rec);
+            assignView(id, rec.id);
+            assignView(seq, rec.seq);
+            assignView(qual, rec.qual);
+            return;
+        }
+        checkInput();
+        seqan::readRecord(id, seq, qual, sqh);
+    }
+
+    void SeqFileInWrapper::readRecord(CharString &id, CharString &seq) {
+        if(mapped.isOpen()) {
+            RecordView rec;
+            readRecord(rec);
+            assignView(id, rec.id);
+            assignView(seq, rec.seq);
+            return;
+        }
+        checkInput();
+        seqan::readRecord(id, seq, sqh);
+    }
+
+    bool SeqFileInWrapper::loadIndex() {
+        if(!mapped.isOpen()) return false;
+        return index.load(filename, mapped.data(), mapped.size(), mapped.format());
+    }
+
+    bool SeqFileInWrapper::buildIndex(bool save) {
+        if(!mapped.isOpen()) return false;
+        index.build(mapped.data(), mapped.size(), mapped.format());
+        if(save) {
+            return index.save(filename);
+        }
+        return true;
+    }
+
+    bool SeqFileInWrapper::hasIndex() const {
+        return mapped.isOpen() && index.format() != 0;
+    }
+
+    size_t SeqFileInWrapper::recordCount() const {
+        return index.size();
+    }
+
+    void SeqFileInWrapper::seekRecord(size_t i) {
+        if(!hasIndex()) {
+            throw std::runtime_error("Can't seek without an index");
+        }
+        if(i >= index.size()) {
+            mapped.seek(mapped.size());
+        } else {
+            mapped.seek(index.recordStart(i, mapped.data()));
+        }
+    }
+
+    bool SeqFileInWrapper::seekTail(size_t n) {
+        size_t offset;
+        if(!mapped.isOpen() || !mapped.findTail(n, offset)) return false;
+        mapped.seek(offset);
+        return true;
+    }
+
+    size_t SeqFileInWrapper::tell() const {
+        return mapped.tell();
+    }
+
+    void SeqFileInWrapper::seek(size_t offset) {
+        if(!mapped.isOpen()) {
+            throw std::runtime_error("Can't seek in a stream");
+        }
+        mapped.seek(offset);
+    }
+
+    void assignView(CharString &target, const StringRef &source) {
+        resize(target, source.size);
+        std::copy(source.begin(), source.end(), begin(target, Standard()));
+    }
 }
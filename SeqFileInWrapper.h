@@ -11,14 +11,41 @@
  *
  * Note that Seqan is supposed to be able to handle gzipped files,
  * but only is SEQAN_HAS_ZLIB is defined as 1 and it is compiled
- * with zlib support. This seems to be a somewhat sketchy feature.
+ * with zlib support. This seems to be a somewhat sketchy feature, so
+ * compressed input (a file or stdin starting with the gzip magic
+ * number) is decompressed here instead, by a GzipStreambuf in front of
+ * SeqFileIn: BGZF on decompress_threads threads, plain gzip with the
+ * reading done on a thread of its own. Compressed input is never
+ * mapped, so it can't be indexed or seeked in.
+ *
+ * Regular FASTA and FASTQ files are read through MappedSeqFile instead
+ * of SeqFileIn unless allow_mmap is turned off. The readRecord members
+ * work the same way in both modes, so programs should use those rather
+ * than calling seqan::readRecord on sqh directly. The RecordView
+ * version avoids copying anything when the file is mapped.
+ *
+ * The LazyRecord version of readRecord only reads the header of a mapped
+ * record; decode() fills in a full RecordView when one is needed. Other
+ * inputs are read in full either way.
+ *
+ * Mapped files can also use a .fai index (see SeqIndex.h) to count
+ * records and to seek straight to a record by number.
  *
  */
 
+#ifndef BLTOOLS_SEQFILEINWRAPPER_H
+#define BLTOOLS_SEQFILEINWRAPPER_H
+
 #include <string>
 #include <iostream>
+#include <memory>
 #include <seqan/seq_io.h>
 
+#include <GzipInput.h>
+#include <MappedSeqFile.h>
+#include <SeqIndex.h>
+#include <StringRef.h>
+
 using std::string;
 using std::cin;
 using std::ifstream;
@@ -32,13 +59,55 @@ namespace bltools {
         private:
             ifstream input;
             istream * input_stream;
+            std::unique_ptr<GzipStreambuf> gzip_buf;
+            std::unique_ptr<istream> gzip_stream;
+            string input_error;         // From decompressing, not yet thrown
+            MappedSeqFile mapped;
+            SeqIndex index;
+            string filename;
+            CharString id_buf;
+            CharString seq_buf;
+            CharString qual_buf;
+            RecordView lazy_view;       // Whole record for unmapped input
+
+            void checkInput() const;
 
         public:
             SeqFileIn sqh;
+            bool allow_mmap = true;
+            unsigned decompress_threads = 0;    // For BGZF; 0 for one per core
 
             void open(char * infile);
             void open(string &infile); 
             bool close();
             bool atEnd();
+            bool isMapped() const;
+
+            void readRecord(RecordView &rec);
+            void readRecord(LazyRecord &rec);
+            void decode(const LazyRecord &rec, RecordView &view);
+            void readRecord(CharString &id, CharString &seq, CharString &qual);
+            void readRecord(CharString &id, CharString &seq);
+
+            // Index support; only for mapped files. loadIndex() uses an
+            // existing, up to date index, buildIndex() scans the file.
+            bool loadIndex();
+            bool buildIndex(bool save);
+            bool hasIndex() const;
+            size_t recordCount() const;
+            void seekRecord(size_t i);
+
+            // Position a mapped file at its last n records without an
+            // index; false if the file isn't mapped or that isn't possible.
+            bool seekTail(size_t n);
+
+            // Byte positions in a mapped file, e.g. from RecordView::offset
+            size_t tell() const;
+            void seek(size_t offset);
     };
+
+    // Copy a view into a SeqAn string, reusing its storage
+    void assignView(CharString &target, const StringRef &source);
 }
+
+#endif
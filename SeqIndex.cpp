@@ -0,0 +1,220 @@
+/*
+ * samtools-compatible .fai index for FASTA and FASTQ; see SeqIndex.h.
+ *
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include <SeqIndex.h>
+
+using std::ifstream;
+using std::ofstream;
+using std::runtime_error;
+using std::string;
+using std::vector;
+
+namespace bltools {
+
+    static size_t lineEnd(const char * data, size_t size, size_t from) {
+        const void * nl = memchr(data + from, '\n', size - from);
+        if(nl == nullptr) return size;
+        return static_cast<const char *>(nl) - data;
+    }
+
+    static size_t lineLength(const char * data, size_t from, size_t eol) {
+        size_t n = eol - from;
+        if(n > 0 && data[eol - 1] == '\r') n--;
+        return n;
+    }
+
+    // Whether a was modified before b, to the nanosecond where the
+    // system keeps it
+    static bool modifiedBefore(const struct stat &a, const struct stat &b) {
+#ifdef __APPLE__
+        const struct timespec &ta = a.st_mtimespec, &tb = b.st_mtimespec;
+#else
+        const struct timespec &ta = a.st_mtim, &tb = b.st_mtim;
+#endif
+        return ta.tv_sec < tb.tv_sec ||
+            (ta.tv_sec == tb.tv_sec && ta.tv_nsec < tb.tv_nsec);
+    }
+
+    // Byte offset just past the last of n bases laid out from offset in
+    // lines of line_bases, line_width bytes apart; 0 if they can't be.
+    static uint64_t basesEnd(uint64_t offset, uint64_t n,
+                             uint64_t line_bases, uint64_t line_width) {
+        if(n == 0) return offset;
+        if(line_bases == 0 || line_width < line_bases) return 0;
+        uint64_t full = (n - 1) / line_bases;
+        return offset + full * line_width + (n - full * line_bases);
+    }
+
+    bool SeqIndex::load(const string &seqfile, const char * data, size_t size,
+                        char format) {
+
+        clear();
+
+        string path = indexPath(seqfile);
+        struct stat seq_st, idx_st;
+        if(stat(seqfile.c_str(), &seq_st) != 0 ||
+           stat(path.c_str(), &idx_st) != 0 ||
+           modifiedBefore(idx_st, seq_st)) {
+            return false;
+        }
+
+        ifstream idx(path.c_str());
+        if(!(idx.is_open() && idx.good())) return false;
+
+        unsigned ncols = format == '@' ? 6 : 5;
+        for(string line; getline(idx, line); ) {
+            if(line.empty()) continue;
+            vector<string> cols;
+            size_t start = 0;
+            for(size_t tab; (tab = line.find('\t', start)) != string::npos;
+                start = tab + 1) {
+                cols.push_back(line.substr(start, tab - start));
+            }
+            cols.push_back(line.substr(start));
+            if(cols.size() != ncols) {
+                entries.clear();
+                return false;
+            }
+            IndexEntry e;
+            e.name = cols[0];
+            e.length = strtoull(cols[1].c_str(), nullptr, 10);
+            e.offset = strtoull(cols[2].c_str(), nullptr, 10);
+            e.line_bases = strtoull(cols[3].c_str(), nullptr, 10);
+            e.line_width = strtoull(cols[4].c_str(), nullptr, 10);
+            e.qual_offset = ncols == 6 ?
+                strtoull(cols[5].c_str(), nullptr, 10) : 0;
+            entries.push_back(e);
+        }
+
+        if(!endsAtEnd(data, size, format)) {
+            entries.clear();
+            return false;
+        }
+
+        fmt = format;
+        return true;
+    }
+
+    bool SeqIndex::endsAtEnd(const char * data, size_t size, char format) const {
+        if(entries.empty()) {
+            for(size_t i = 0; i < size; i++) {
+                if(data[i] != '\n' && data[i] != '\r') return false;
+            }
+            return true;
+        }
+
+        // The last entry's first base must follow a header line...
+        const IndexEntry &e = entries.back();
+        if(e.offset == 0 || e.offset > size || data[e.offset - 1] != '\n') {
+            return false;
+        }
+
+        // ...and its last base (or quality) be followed only by line
+        // breaks up to the end of the file.
+        uint64_t start = format == '@' ? e.qual_offset : e.offset;
+        if(format == '@' && (start == 0 || start > size)) return false;
+        uint64_t end = basesEnd(start, e.length, e.line_bases, e.line_width);
+        if(end == 0 || end > size) return false;
+        if(e.length > 0 && (data[end - 1] == '\n' || data[end - 1] == '\r')) {
+            return false;
+        }
+        for(uint64_t i = end; i < size; i++) {
+            if(data[i] != '\n' && data[i] != '\r') return false;
+        }
+        return true;
+    }
+
+    void SeqIndex::build(const char * data, size_t size, char format) {
+
+        clear();
+        fmt = format;
+
+        char stop = fmt == '>' ? '>' : '+';
+        size_t pos = 0;
+        while(pos < size) {
+
+            if(data[pos] == '\n' || data[pos] == '\r') {
+                pos++;
+                continue;
+            }
+            if(data[pos] != fmt) {
+                throw runtime_error("Can't index: record does not start with '" +
+                                    string(1, fmt) + "'");
+            }
+
+            IndexEntry e;
+            size_t eol = lineEnd(data, size, pos);
+            size_t name_end = pos + 1;
+            while(name_end < eol && data[name_end] != ' ' &&
+                  data[name_end] != '\t' && data[name_end] != '\r') {
+                name_end++;
+            }
+            e.name.assign(data + pos + 1, name_end - pos - 1);
+            pos = eol < size ? eol + 1 : size;
+            e.offset = pos;
+            e.length = 0;
+            e.line_bases = 0;
+            e.line_width = 0;
+            e.qual_offset = 0;
+
+            while(pos < size && data[pos] != stop) {
+                eol = lineEnd(data, size, pos);
+                size_t n = lineLength(data, pos, eol);
+                if(e.line_bases == 0 && n > 0) {
+                    e.line_bases = n;
+                    e.line_width = (eol < size ? eol + 1 : size) - pos;
+                }
+                e.length += n;
+                pos = eol < size ? eol + 1 : size;
+            }
+
+            if(fmt == '@') {
+                if(pos >= size) {
+                    throw runtime_error("Can't index: unexpected end of fastq file");
+                }
+                eol = lineEnd(data, size, pos);     // '+' line
+                pos = eol < size ? eol + 1 : size;
+                e.qual_offset = pos;
+                uint64_t qlen = 0;
+                while(pos < size && qlen < e.length) {
+                    eol = lineEnd(data, size, pos);
+                    qlen += lineLength(data, pos, eol);
+                    pos = eol < size ? eol + 1 : size;
+                }
+            }
+
+            entries.push_back(e);
+        }
+    }
+
+    bool SeqIndex::save(const string &seqfile) const {
+        ofstream idx(indexPath(seqfile).c_str());
+        if(!(idx.is_open() && idx.good())) return false;
+        for(const IndexEntry &e: entries) {
+            idx << e.name << '\t' << e.length << '\t' << e.offset << '\t'
+                << e.line_bases << '\t' << e.line_width;
+            if(fmt == '@') idx << '\t' << e.qual_offset;
+            idx << '\n';
+        }
+        return idx.good();
+    }
+
+    uint64_t SeqIndex::recordStart(size_t i, const char * data) const {
+        // offset - 1 is the line break ending the header line
+        uint64_t p = entries[i].offset;
+        if(p > 0) p--;
+        while(p > 0 && data[p - 1] != '\n') p--;
+        return p;
+    }
+}
@@ -0,0 +1,74 @@
+/*
+ * Record index compatible with samtools faidx.
+ *
+ * FASTA indices have the usual five tab-separated columns (NAME, LENGTH,
+ * OFFSET, LINEBASES, LINEWIDTH); FASTQ indices add a sixth, QUALOFFSET,
+ * the same as `samtools fqidx'. Both live next to the data in
+ * "<file>.fai", so an index written by samtools can be used here and
+ * vice versa.
+ *
+ * OFFSET points at the first base of a record, not at its header. The
+ * header is found by backing up one line, which is how recordStart()
+ * turns an entry into something MappedSeqFile can seek to.
+ *
+ */
+
+#ifndef BLTOOLS_SEQINDEX_H
+#define BLTOOLS_SEQINDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+namespace bltools {
+
+    struct IndexEntry {
+        string name;            // First word of the header
+        uint64_t length;        // Number of bases
+        uint64_t offset;        // Byte offset of the first base
+        uint64_t line_bases;    // Bases per sequence line
+        uint64_t line_width;    // Bytes per sequence line, with line break
+        uint64_t qual_offset;   // Byte offset of the first quality (fastq)
+    };
+
+    class SeqIndex {
+
+        private:
+            char fmt;
+
+            // Whether the last entry ends with the file
+            bool endsAtEnd(const char * data, size_t size, char fmt) const;
+
+        public:
+            vector<IndexEntry> entries;
+
+            SeqIndex() : fmt(0) {}
+
+            // Load an existing index for seqfile, whose contents are
+            // data; fails if it is missing, older than seqfile, doesn't
+            // have the right columns for fmt, or its last record doesn't
+            // end where data does.
+            bool load(const string &seqfile, const char * data, size_t size,
+                      char fmt);
+            void build(const char * data, size_t size, char fmt);
+            bool save(const string &seqfile) const;
+            void clear() { entries.clear(); fmt = 0; }
+
+            bool empty() const { return entries.empty(); }
+            size_t size() const { return entries.size(); }
+            char format() const { return fmt; }
+
+            // Byte offset of the '>' or '@' that starts record i
+            uint64_t recordStart(size_t i, const char * data) const;
+
+            static string indexPath(const string &seqfile) {
+                return seqfile + ".fai";
+            }
+    };
+}
+
+#endif
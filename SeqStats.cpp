@@ -0,0 +1,89 @@
+/*
+ * Streaming sequence statistics; see SeqStats.h.
+ *
+ */
+
+#include <cstdint>
+#include <limits>
+#include <map>
+
+#include <Composition.h>
+#include <SeqStats.h>
+
+namespace bltools {
+
+    static const double NOT_A_NUMBER = std::numeric_limits<double>::quiet_NaN();
+
+    SeqStats::SeqStats(bool include_gaps) :
+        include_gaps(include_gaps), nrecords(0) {}
+
+    void SeqStats::add(const char * begin, const char * end) {
+        Composition record;
+        record.add(begin, end);
+        add(record);
+    }
+
+    void SeqStats::add(const Composition &record) {
+        nrecords++;
+        lengths[record.bases(include_gaps)]++;
+        counts += record;
+    }
+
+    SeqStats & SeqStats::operator+=(const SeqStats &other) {
+        nrecords += other.nrecords;
+        for(const auto &l: other.lengths) lengths[l.first] += l.second;
+        counts += other.counts;
+        return *this;
+    }
+
+    uint64_t SeqStats::minLength() const {
+        return lengths.empty() ? 0 : lengths.begin()->first;
+    }
+
+    uint64_t SeqStats::maxLength() const {
+        return lengths.empty() ? 0 : lengths.rbegin()->first;
+    }
+
+    double SeqStats::meanLength() const {
+        if(nrecords == 0) return NOT_A_NUMBER;
+        return (double) bases() / nrecords;
+    }
+
+    double SeqStats::gcFraction() const {
+        uint64_t n = bases();
+        return n == 0 ? NOT_A_NUMBER : (double) counts.gc() / n;
+    }
+
+    double SeqStats::gapFraction() const {
+        uint64_t n = counts.bases(true);
+        return n == 0 ? NOT_A_NUMBER : (double) counts[BASE_GAP] / n;
+    }
+
+    uint64_t SeqStats::n50() const {
+        uint64_t total = bases();
+        if(total == 0) return 0;
+        uint64_t sum = 0;
+        for(auto l = lengths.rbegin(); l != lengths.rend(); ++l) {
+            sum += l->first * l->second;
+            if(2 * sum >= total) return l->first;
+        }
+        return 0;
+    }
+
+    uint64_t SeqStats::l50() const {
+        uint64_t total = bases();
+        if(total == 0) return 0;
+        uint64_t sum = 0;
+        uint64_t nrecs = 0;
+        for(auto l = lengths.rbegin(); l != lengths.rend(); ++l) {
+            if(2 * (sum + l->first * l->second) >= total) {
+                // Only as many records of this length as it takes
+                uint64_t missing = total - 2 * sum;
+                return nrecs + (missing + 2 * l->first - 1) / (2 * l->first);
+            }
+            sum += l->first * l->second;
+            nrecs += l->second;
+        }
+        return nrecs;
+    }
+}
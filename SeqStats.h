@@ -0,0 +1,70 @@
+/*
+ * Summary statistics over a set of sequences (blwc -s), gathered in one
+ * pass: record count, min/max/mean length, N50 and L50, GC and gap
+ * fractions, and the histogram of lengths they come from.
+ *
+ * Only the histogram and a Composition are kept, so memory depends on
+ * the number of distinct lengths, not on the number of records. Two
+ * SeqStats merge with +=, which is how per-file totals, and results for
+ * parts of a file counted separately, are combined without reading
+ * anything again.
+ *
+ * A record's length is its base count as blwc has always given it: gaps
+ * are left out unless include_gaps is set. GC is a fraction of the same
+ * count; gaps are a fraction of every base, gap or not.
+ *
+ */
+
+#ifndef BLTOOLS_SEQSTATS_H
+#define BLTOOLS_SEQSTATS_H
+
+#include <cstdint>
+#include <map>
+
+#include <Composition.h>
+
+namespace bltools {
+
+    class SeqStats {
+
+        private:
+            bool include_gaps;
+            uint64_t nrecords;
+            std::map<uint64_t, uint64_t> lengths;   // Length -> records
+            Composition counts;
+
+        public:
+            explicit SeqStats(bool include_gaps = false);
+
+            // Add one record, from its sequence or its composition
+            void add(const char * begin, const char * end);
+            void add(const Composition &record);
+
+            // Both sides must agree on include_gaps
+            SeqStats & operator+=(const SeqStats &other);
+
+            bool includeGaps() const { return include_gaps; }
+            uint64_t records() const { return nrecords; }
+            uint64_t bases() const { return counts.bases(include_gaps); }
+            const Composition & composition() const { return counts; }
+            const std::map<uint64_t, uint64_t> & lengthHistogram() const {
+                return lengths;
+            }
+
+            // Lengths are 0 and fractions NaN when there are no records
+            // or no bases to divide by.
+            uint64_t minLength() const;
+            uint64_t maxLength() const;
+            double meanLength() const;
+            double gcFraction() const;
+            double gapFraction() const;
+
+            // Length of the shortest record among the longest ones that
+            // together hold at least half the bases, and how many of
+            // them that takes.
+            uint64_t n50() const;
+            uint64_t l50() const;
+    };
+}
+
+#endif
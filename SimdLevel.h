@@ -0,0 +1,33 @@
+/*
+ * Run time choice of x86 vector instructions, for the files with SSE2
+ * and AVX2 loops (Composition.cpp, FixedSearch.cpp). Including it on
+ * x86 brings in the intrinsics and defines BLTOOLS_X86; simdLevel()
+ * asks the CPU once and remembers the answer.
+ *
+ */
+
+#ifndef BLTOOLS_SIMDLEVEL_H
+#define BLTOOLS_SIMDLEVEL_H
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BLTOOLS_X86 1
+#endif
+
+namespace bltools {
+
+#ifdef BLTOOLS_X86
+
+    enum SimdLevel { SIMD_NONE, SIMD_SSE2, SIMD_AVX2 };
+
+    inline SimdLevel simdLevel() {
+        static const SimdLevel level =
+            __builtin_cpu_supports("avx2") ? SIMD_AVX2 :
+            __builtin_cpu_supports("sse2") ? SIMD_SSE2 : SIMD_NONE;
+        return level;
+    }
+
+#endif
+}
+
+#endif
@@ -0,0 +1,50 @@
+/*
+ * Non-owning view of a run of characters: a pointer plus a length.
+ *
+ * The memory-mapped reader hands out record fields as StringRefs that
+ * point straight into the mapping, so nothing is copied until a tool
+ * actually needs its own string (usually only for output).
+ *
+ */
+
+#ifndef BLTOOLS_STRINGREF_H
+#define BLTOOLS_STRINGREF_H
+
+#include <cstddef>
+#include <cstring>
+#include <ostream>
+#include <string>
+
+namespace bltools {
+
+    struct StringRef {
+
+        const char * data;
+        size_t size;
+
+        StringRef() : data(nullptr), size(0) {}
+        StringRef(const char * d, size_t n) : data(d), size(n) {}
+        StringRef(const std::string &s) : data(s.data()), size(s.size()) {}
+
+        const char * begin() const { return data; }
+        const char * end() const { return data + size; }
+        bool empty() const { return size == 0; }
+        char operator[](size_t i) const { return data[i]; }
+
+        std::string str() const { return std::string(data, size); }
+
+        bool operator==(const StringRef &other) const {
+            return size == other.size &&
+                (size == 0 || memcmp(data, other.data, size) == 0);
+        }
+        bool operator!=(const StringRef &other) const {
+            return !(*this == other);
+        }
+    };
+
+    inline std::ostream & operator<<(std::ostream &os, const StringRef &s) {
+        return os.write(s.data, s.size);
+    }
+}
+
+#endif
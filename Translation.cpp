@@ -0,0 +1,80 @@
+/*
+ * Codon table translation; see Translation.h.
+ *
+ */
+
+#include <string>
+#include <vector>
+
+#include <StringRef.h>
+#include <Translation.h>
+
+using std::string;
+using std::vector;
+
+namespace bltools {
+
+    Translator::Translator() {
+
+        // Standard code, codons in ACGT order: AAA, AAC, AAG, AAT, ACA...
+        static const char * code =
+            "KNKNTTTTRSRSIIMIQHQHPPPPRRRRLLLLEDEDAAAAGGGGVVVV*Y*YSSSS*CWCLFLF";
+
+        for(int c = 0; c < 256; c++) base_code[c] = 4;
+        base_code['A'] = base_code['a'] = 0;
+        base_code['C'] = base_code['c'] = 1;
+        base_code['G'] = base_code['g'] = 2;
+        base_code['T'] = base_code['t'] = 3;
+        base_code['U'] = base_code['u'] = 3;
+
+        for(int b0 = 0; b0 < 5; b0++) {
+            for(int b1 = 0; b1 < 5; b1++) {
+                for(int b2 = 0; b2 < 5; b2++) {
+                    int i = b0 * 25 + b1 * 5 + b2;
+                    bool n = b0 == 4 || b1 == 4 || b2 == 4;
+                    // Reverse complement of b0 b1 b2 is ~b2 ~b1 ~b0
+                    forward_aa[i] = n ? 'X' : code[b0 * 16 + b1 * 4 + b2];
+                    revcomp_aa[i] = n ? 'X' :
+                        code[(3 - b2) * 16 + (3 - b1) * 4 + (3 - b0)];
+                }
+            }
+        }
+    }
+
+    void Translator::translate(const StringRef &seq, const ReadingFrame &frame,
+                               string &out) const {
+        size_t n = seq.size > frame.shift ? (seq.size - frame.shift) / 3 : 0;
+        out.resize(n);
+        const unsigned char * s = reinterpret_cast<const unsigned char *>(seq.data);
+        if(!frame.revcomp) {
+            const unsigned char * p = s + frame.shift;
+            for(size_t i = 0; i < n; i++, p += 3) {
+                out[i] = forward_aa[base_code[p[0]] * 25 + base_code[p[1]] * 5 +
+                                    base_code[p[2]]];
+            }
+        } else {
+            // Codon i of the reverse strand is the reverse complement of
+            // the three bases ending frame.shift + 3i from the end.
+            size_t end = seq.size - frame.shift;
+            for(size_t i = 0; i < n; i++) {
+                const unsigned char * p = s + end - 3 * (i + 1);
+                out[i] = revcomp_aa[base_code[p[0]] * 25 + base_code[p[1]] * 5 +
+                                    base_code[p[2]]];
+            }
+        }
+    }
+
+    vector<ReadingFrame> Translator::frames(int frame_option) {
+        switch(frame_option) {
+        case 1:
+            return {{0, false}, {0, true}};
+        case 2:
+            return {{0, false}, {1, false}, {2, false}};
+        case 3:
+            return {{0, false}, {1, false}, {2, false},
+                    {0, true}, {1, true}, {2, true}};
+        default:
+            return {{0, false}};
+        }
+    }
+}
@@ -0,0 +1,57 @@
+/*
+ * Table-driven translation of nucleotide sequences, for blgrep -M t.
+ *
+ * Bases are coded A=0, C=1, G=2, T/U=3 and anything else 4 (N), the way
+ * SeqAn converts to Dna5, so a codon is one of 125 codes and its amino
+ * acid one lookup in a packed table; codons with an N come out as X,
+ * stops as '*'. A second table holds the amino acid of the reverse
+ * complement of each codon, so reverse strand frames are read straight
+ * from the sequence, walking backwards, with no complemented copy.
+ *
+ * Frames are translated one at a time into a caller's buffer, which is
+ * reused, so a caller can search each frame as soon as it is made and
+ * skip the rest once one matches. The standard genetic code is used,
+ * as with SeqAn's translate().
+ *
+ */
+
+#ifndef BLTOOLS_TRANSLATION_H
+#define BLTOOLS_TRANSLATION_H
+
+#include <string>
+#include <vector>
+
+#include <StringRef.h>
+
+using std::string;
+using std::vector;
+
+namespace bltools {
+
+    struct ReadingFrame {
+        unsigned shift;         // 0, 1 or 2 bases from the start of the strand
+        bool revcomp;           // Reverse complement strand
+    };
+
+    class Translator {
+
+        private:
+            unsigned char base_code[256];
+            char forward_aa[125];
+            char revcomp_aa[125];
+
+        public:
+            Translator();
+
+            // Translate frame of seq into out; a partial codon at the end
+            // is dropped.
+            void translate(const StringRef &seq, const ReadingFrame &frame,
+                           string &out) const;
+
+            // The frames SeqAn's SINGLE_FRAME, WITH_REVERSE_COMPLEMENT,
+            // WITH_FRAME_SHIFTS and SIX_FRAME (0-3, blgrep -F) stand for
+            static vector<ReadingFrame> frames(int frame_option);
+    };
+}
+
+#endif
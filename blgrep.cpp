@@ -1,7 +1,9 @@
 /*
  * Seqan-based program for grepping sequence files. Right now it uses
  * a regex approach to all the matching, but I would like to implement
- * a biological matching approach too.
+ * a biological matching approach too. Regexes are POSIX extended ones,
+ * run by the lazy DFA in LazyDfa.h rather than std::regex, so matching
+ * time is linear in the record length whatever the pattern.
  *
  * It refuses to read genbank files with a ".gb" extension unless they are
  * piped in. I can't seem to convince SeqFileIn that genbank is the format.
@@ -16,35 +18,428 @@
  *      regex_search or runs a biological pattern matching search, I
  *      could make it work. If it is a template, I might be able to do
  *      something about the problem of treating all sequences as Dna.
- *    - Fixed string match not using regex (just string1 == string2);
- *      probably best implemented with a wrapper function for matching
- *      that could deal with a regex, a string, or a biological pattern.
+ *
+ * Fixed strings (-L, --iupac) are searched for with FixedSearch rather
+ * than a regex, and approximate matches (-e) with ApproxSearch;
+ * MultiPattern decides which matcher each pattern gets.
  *
  */
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
-#include <regex>
+#include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <seqan/seq_io.h>
-#include <seqan/translation.h>
 
 #include <tclap/CmdLine.h>
 
+#include <BgzfOutput.h>
+#include <BoundedQueue.h>
+#include <DebugAllocs.h>
+#include <FileJobs.h>
+#include <FixedSearch.h>
+#include <IdKey.h>
+#include <IdTable.h>
+#include <MultiPattern.h>
+#include <ReorderBuffer.h>
 #include <SeqFileInWrapper.h>
+#include <Translation.h>
 
 using std::cout;
 using std::cerr;
 using std::endl;
-using std::regex;
-using std::regex_match;
+using std::ostream;
 using std::string;
 using std::vector;
 
 using namespace seqan;
 using namespace bltools;
 
+// How records are matched, worked out once before reading: by name, or
+// (with -S) by sequence on each strand in match_type. The reverse and
+// complement strands are handled by compiling reversed and complemented
+// copies of the patterns into the same matchers, so the sequence is
+// scanned once as it is and never copied; only translation builds new
+// strings, into a buffer reused from record to record. Each worker
+// thread gets its own copy.
+struct MatchPlan {
+  MultiPattern patterns;       // Names, or the strands of the sequence
+  MultiPattern protein_patterns;       // Translations, forward only
+  bool seq_regex;
+  unsigned strands;            // STRAND_ flags
+  bool translated;
+  vector<ReadingFrame> frames;
+  Translator translator;
+  string protein;              // One frame at a time, reused
+
+  MatchPlan(const MultiPattern &patterns, bool seq_regex,
+            const string &match_type, const vector<ReadingFrame> &frames);
+
+  MatchPlan(const MatchPlan &other) :
+    patterns(other.patterns), protein_patterns(other.protein_patterns),
+    seq_regex(other.seq_regex), strands(other.strands),
+    translated(other.translated), frames(other.frames) {}
+
+  // Throws runtime_error if a pattern is malformed
+  void compile();
+  bool matches(const RecordView &rec);
+};
+
+MatchPlan::MatchPlan(const MultiPattern &patterns, bool seq_regex,
+                     const string &match_type,
+                     const vector<ReadingFrame> &frames) :
+  patterns(patterns), protein_patterns(patterns), seq_regex(seq_regex),
+  strands(0), translated(false), frames(frames) {
+
+  if(!seq_regex) {
+    strands = STRAND_FORWARD;
+    return;
+  }
+
+  // 'a' means all strands and 'A' all strands plus translation
+  string expanded = match_type;
+  if(expanded.find('a') != string::npos) expanded = "frcR";
+  if(expanded.find('A') != string::npos) expanded = "frcRt";
+  for(const char &c: expanded) {
+    switch(c) {
+    case 'f': strands |= STRAND_FORWARD; break;
+    case 'r': strands |= STRAND_REVERSE; break;
+    case 'c': strands |= STRAND_COMPLEMENT; break;
+    case 'R': strands |= STRAND_REVCOMP; break;
+    case 't': translated = true; break;
+    }
+  }
+}
+
+void MatchPlan::compile() {
+  patterns.compile(strands);
+  if(translated) protein_patterns.compile();
+}
+
+bool MatchPlan::matches(const RecordView &rec) {
+
+  // Simple regex on sequence IDs
+  if(!seq_regex) return patterns.search(rec.id.begin(), rec.id.end());
+
+  // Every requested strand at once. The complement assumes DNA, not
+  // RNA, as SeqAn's Dna5 complement does, though U is taken as T.
+  if(strands != 0 && patterns.search(rec.seq.begin(), rec.seq.end())) {
+    return true;
+  }
+
+  // Each frame is searched as soon as it is translated
+  if(translated) {
+    for(const ReadingFrame &f: frames) {
+      translator.translate(rec.seq, f, protein);
+      if(protein_patterns.search(protein.data(), protein.data() + protein.size())) {
+        return true;
+      }
+    } // End loop over translation frames
+  }
+  return false;
+}
+
+// Records copied out of the input for the worker threads. Field
+// positions are kept as offsets, since data moves as it grows.
+struct RecordBatch {
+  size_t number;               // Order of the batch in the input
+  string data;
+  vector<size_t> fields;       // Offset and length of id, seq and qual
+  vector<char> matched;
+
+  size_t size() const { return fields.size() / 6; }
+
+  void clear() {
+    data.clear();
+    fields.clear();
+    matched.clear();
+  }
+
+  void add(const RecordView &rec) {
+    for(const StringRef &f: {rec.id, rec.seq, rec.qual}) {
+      fields.push_back(data.size());
+      fields.push_back(f.size);
+      data.append(f.data, f.size);
+    }
+  }
+
+  RecordView record(size_t i) const {
+    const size_t * f = &fields[6 * i];
+    RecordView rec;
+    rec.id = StringRef(data.data() + f[0], f[1]);
+    rec.seq = StringRef(data.data() + f[2], f[3]);
+    rec.qual = StringRef(data.data() + f[4], f[5]);
+    rec.offset = 0;
+    rec.length = 0;
+    return rec;
+  }
+};
+
+// -t: this thread reads the input into batches, nthreads workers match
+// them and a writer thread prints the matches, in input order unless
+// ordered is false. There are never more batches in flight than the
+// pool holds, so memory use doesn't depend on the input. Returns false
+// after a read or write error.
+bool grepThreaded(vector<string> &infiles, const MatchPlan &plan,
+                  bool inverted, unsigned nthreads, bool ordered,
+                  SeqFileOut &out_handle, int &nmatched) {
+
+  const size_t BATCH_RECORDS = 1024;
+  const size_t BATCH_BYTES = 1 << 20;
+
+  vector<RecordBatch> pool(2 * nthreads + 2);
+  BoundedQueue<RecordBatch *> free_batches(pool.size());
+  BoundedQueue<RecordBatch *> todo(pool.size());
+  BoundedQueue<RecordBatch *> done(pool.size());
+  for(RecordBatch &b: pool) free_batches.push(&b);
+  std::atomic<bool> write_failed(false);
+
+  // Workers
+  vector<std::thread> workers;
+  for(unsigned t = 0; t < nthreads; t++) {
+    workers.emplace_back([&plan, &todo, &done, inverted]() {
+      MatchPlan m(plan);
+      RecordBatch * b;
+      while(todo.pop(b)) {
+        b->matched.resize(b->size());
+        for(size_t i = 0; i < b->size(); i++) {
+          b->matched[i] = m.matches(b->record(i)) != inverted;
+        }
+        done.push(b);
+      }
+    });
+  }
+
+  // Writer; batches that arrive early wait until their turn
+  std::thread writer([&]() {
+    CharString id;
+    CharString seq;
+    CharString qual;
+    auto write = [&](RecordBatch * b) {
+      for(size_t i = 0; i < b->size() && !write_failed; i++) {
+        if(!b->matched[i]) continue;
+        nmatched++;
+        RecordView rec = b->record(i);
+        try {
+          assignView(id, rec.id);
+          assignView(seq, rec.seq);
+          assignView(qual, rec.qual);
+          writeRecord(out_handle, id, seq, qual);
+        } catch (Exception const &e) {
+          cerr << "Error: " << e.what() << endl;
+          cerr << "Error writing output" << endl;
+          write_failed = true;
+        }
+      }
+      b->clear();
+      free_batches.push(b);
+    };
+    ReorderBuffer<RecordBatch *> waiting;
+    RecordBatch * b;
+    while(done.pop(b)) {
+      if(!ordered) {
+        write(b);
+        continue;
+      }
+      waiting.add(b->number, b);
+      while(waiting.pop(b)) write(b);
+    }
+  });
+
+  // Reader
+  bool ok = true;
+  size_t nbatches = 0;
+  RecordBatch * b = nullptr;
+  RecordView rec;
+  SeqFileInWrapper seq_handle;
+  for(string& infile: infiles) {
+
+    try {
+        seq_handle.open(infile);
+    } catch(Exception const &e) {
+      cerr << "Could not open " << infile << endl;
+      seq_handle.close();
+      ok = false;
+      break;
+    }
+
+    while(!seq_handle.atEnd() && !write_failed) {
+      try {
+        seq_handle.readRecord(rec);
+      } catch (Exception const &e) {
+        cerr << "Error: " << e.what() << endl;
+        ok = false;
+        break;
+      }
+      if(b == nullptr) {
+        free_batches.pop(b);
+        b->number = nbatches++;
+      }
+      b->add(rec);
+      if(b->size() >= BATCH_RECORDS || b->data.size() >= BATCH_BYTES) {
+        todo.push(b);
+        b = nullptr;
+      }
+    }
+
+    if(!seq_handle.close() && ok) {
+      cerr << "Problem closing " << infile << endl;
+      ok = false;
+    }
+    if(!ok || write_failed) break;
+  }
+  if(b != nullptr) todo.push(b);
+
+  todo.close();
+  for(std::thread &w: workers) w.join();
+  done.close();
+  writer.join();
+  return ok && !write_failed;
+}
+
+// -u: which of the -x IDs have been seen so far, over all files
+struct IdsLeft {
+  vector<bool> found;
+  size_t nfound;
+
+  explicit IdsLeft(size_t nids) : found(nids, false), nfound(0) {}
+
+  bool allFound() const { return nfound == found.size(); }
+};
+
+// Totals over all files; each -j job adds its own when it is done
+struct GrepTotals {
+  std::atomic<int> nmatched;
+  std::atomic<size_t> nrecords;
+  std::atomic<size_t> match_allocs;    // Only counted in a debug build
+
+  GrepTotals() : nmatched(0), nrecords(0), match_allocs(0) {}
+};
+
+// Grep one file, printing matches to out and errors to err. ids_left
+// is only given with -u, which reads the files one at a time. Returns
+// the exit status; finding no matches isn't an error here.
+static int grepFile(const string &infile, MatchPlan plan, const string &format,
+                    bool exact_ids, const IdTable &id_table,
+                    const IdKey &id_key, IdsLeft * ids_left, bool inverted,
+                    ostream &out, ostream &err, GrepTotals &totals) {
+
+  // With -u, every ID was found in an earlier file
+  if(ids_left != nullptr && ids_left->allFound()) return 0;
+
+  SeqFileOut out_handle(out, Fasta());
+  if(format == "fastq") {
+    setFormat(out_handle, Fastq());
+  }
+
+  RecordView rec;              // Points into the input; copied only if needed
+  LazyRecord header;           // Name searches only parse the header first
+  CharString id;
+  CharString seq;              // CharString more flexible than Dna5String
+  CharString qual;
+  SeqFileInWrapper seq_handle;
+  bool seq_regex = plan.seq_regex;
+  int nmatched = 0;
+  size_t nrecords = 0;
+  size_t match_allocs = 0;
+
+  try {
+      seq_handle.open(infile);
+  } catch(Exception const &e) {
+    err << "Could not open " << infile << endl;
+    seq_handle.close();
+    return 1;
+  }
+
+  bool matched = false;
+  while(!seq_handle.atEnd()) {
+
+    try {
+
+      // Sequence searches need the whole record anyway, so only name
+      // searches read the header first
+      if(seq_regex) {
+        seq_handle.readRecord(rec);
+      } else {
+        seq_handle.readRecord(header);
+        rec.id = header.id;
+      }
+    } catch (Exception const &e) {
+
+      err << "Error: " << e.what() << endl;
+      seq_handle.close();
+      close(out_handle);
+      return 1;
+
+    } // End try-catch for record reading.
+
+
+    // All of the patterns are searched for at once in each version of
+    // the record.
+    matched = false;
+    size_t allocs_before = allocationCount();
+    if(exact_ids) {
+
+      // One hash lookup on the ID or one of its fields
+      StringRef key;
+      if(id_key.extract(rec.id, key)) {
+        uint32_t row = id_table.find(key);
+        matched = row != IdTable::NOT_FOUND;
+        if(matched && ids_left != nullptr && !ids_left->found[row]) {
+          ids_left->found[row] = true;
+          ids_left->nfound++;
+        }
+      }
+
+    } else {
+
+      matched = plan.matches(rec);
+
+    } // End regex if/else
+    match_allocs += allocationCount() - allocs_before;
+    nrecords++;
+
+    // Write out if matched
+    if((matched && !inverted) || (!matched && inverted)) {
+      nmatched++;
+      try {
+          if(!seq_regex) seq_handle.decode(header, rec);
+          assignView(id, rec.id);
+          assignView(seq, rec.seq);
+          assignView(qual, rec.qual);
+          writeRecord(out_handle, id, seq, qual);
+      } catch (Exception const &e) {
+          err << "Error: " << e.what() << endl;
+          err << "Error writing output" << endl;
+          seq_handle.close();
+          return 1;
+      }
+    } // End write out if matched
+
+    // With -u, every ID has been seen; nothing left to look for
+    if(ids_left != nullptr && ids_left->allFound()) break;
+
+  } // End single file reading loop
+
+
+  // Close the input handle and check for errors
+  if(!seq_handle.close()) {
+      err << "Problem closing " << infile << endl;
+      close(out_handle);
+      return 1;
+  }
+  close(out_handle);
+
+  totals.nmatched += nmatched;
+  totals.nrecords += nrecords;
+  totals.match_allocs += match_allocs;
+  return 0;
+}
+
 int main(int argc, char * argv[]) {
 
   /*
@@ -70,9 +465,43 @@ int main(int argc, char * argv[]) {
   TCLAP::ValueArg<int> frame_arg("F", "frame",
                                  "Frame for translation: 0=fwd frame, 1=fwd + revcomp, 2=all 3 fwd, 3=all 6",
                                  false, 0, "string", cmd);
+  TCLAP::SwitchArg fixed_arg("L", "fixed-strings",
+                             "PATTERN is a plain string, not a regex (like grep -F)",
+                             cmd);
+  TCLAP::SwitchArg iupac_arg("", "iupac",
+                             "PATTERN is a nucleotide string with IUPAC codes (e.g. R, Y, N); sets -L",
+                             cmd);
+  TCLAP::ValueArg<unsigned> max_errors_arg("e", "max-errors",
+                                           "Match PATTERN with up to this many mismatches, insertions or deletions; sets -L",
+                                           false, 0, "int", cmd);
+  TCLAP::SwitchArg exact_ids_arg("x", "exact-ids",
+                                 "PATTERN is a file of IDs, one per line; print records whose ID (or field -k of it) is exactly one of them",
+                                 cmd);
+  TCLAP::ValueArg<unsigned> field_arg("k", "field",
+                                      "Field (1-based) of the ID to look up with -x; default is the whole ID",
+                                      false, 0, "int", cmd);
+  TCLAP::ValueArg<string> delim_arg("d", "delim",
+                                    "Field separator(s) for -k", false, " ", "string", cmd);
+  TCLAP::SwitchArg until_found_arg("u", "until-all-found",
+                                   "With -x, stop reading once every ID has been found", cmd);
+  TCLAP::ValueArg<unsigned> threads_arg("t", "threads",
+                                        "Number of threads to match records with; not used with -x",
+                                        false, 1, "int", cmd);
+  TCLAP::ValueArg<unsigned> jobs_arg("j", "jobs",
+                                     "Number of files to read at once; not with -t or -u",
+                                     false, 1, "int", cmd);
+  TCLAP::SwitchArg unordered_arg("", "unordered",
+                                 "With -t, print matches as soon as they are found instead of in input order",
+                                 cmd);
   TCLAP::ValueArg<string> format_arg("o", "output-format",
                                      "Output format: fasta or fastq; fasta is default; will not print fastq if there aren't quality strings",
                                      false, "fasta", "fast[aq]", cmd);
+  TCLAP::SwitchArg bgzf_arg("z", "bgzf",
+                            "Compress the output as BGZF (readable as gzip)",
+                            cmd);
+  TCLAP::ValueArg<string> gzi_arg("", "gzi",
+                                  "With -z, also write a .gzi index of the output to this file",
+                                  false, "", "file", cmd);
   TCLAP::UnlabeledValueArg<string> regex_string_arg("PATTERN", "regex pattern",
                                                     true, "",
                                                     "regex", cmd, false);
@@ -87,19 +516,58 @@ int main(int argc, char * argv[]) {
   int frame = frame_arg.getValue();
   string format = format_arg.getValue();
   bool regex_in_file = file_switch_arg.getValue();
+  bool exact_ids = exact_ids_arg.getValue();
+  unsigned field = field_arg.getValue();
+  string delim = delim_arg.getValue();
+  bool until_found = until_found_arg.getValue();
+  bool ignore_case = ignore_case_arg.getValue();
+  bool iupac = iupac_arg.getValue();
+  unsigned max_errors = max_errors_arg.getValue();
+  bool fixed = fixed_arg.getValue() || iupac || max_errors > 0;
+  unsigned nthreads = threads_arg.getValue();
+  bool ordered = !unordered_arg.getValue();
+  unsigned njobs = jobs_arg.getValue();
+  if(exact_ids && seq_regex) {
+    cerr << "Error: -x matches IDs and can't be combined with -S" << endl;
+    return 1;
+  }
+  if(until_found && (!exact_ids || inverted)) {
+    cerr << "Error: -u only works with -x and without -v" << endl;
+    return 1;
+  }
+  // -t already keeps several threads busy on one stream of records, and
+  // -u has to see the files in order to know when to stop.
+  if(njobs > 1 && ((nthreads > 1 && !exact_ids) || until_found)) {
+    cerr << "Error: -j can't be combined with -t or -u" << endl;
+    return 1;
+  }
+  std::unique_ptr<BgzfCout> compressed;    // With -z, until main returns
+  if(!compressCout(bgzf_arg.getValue(), gzi_arg.getValue(), compressed)) {
+    return 1;
+  }
 
   // Regex setup
-  vector<regex> regex_patterns;
-  std::regex_constants::syntax_option_type regex_flags =
-    regex::extended | regex::optimize;
-  std::regex_constants::match_flag_type regex_match_flags =
-    std::regex_constants::match_any | std::regex_constants::match_not_null;
-  if(ignore_case_arg.getValue() ||
-     (seq_regex && !case_sensitive_arg.getValue())) {
-    regex_flags |= regex::icase;
-  }
-  if(regex_in_file) {
-      // Read regex's from file
+  bool icase = ignore_case_arg.getValue() ||
+    (seq_regex && !case_sensitive_arg.getValue());
+  MultiPattern patterns(icase, fixed, iupac, max_errors);
+  IdTable id_table(ignore_case);  // Folds case itself with -x -i
+  IdKey id_key(field, delim);
+  if(exact_ids) {
+      ifstream id_stream(regex_string_arg.getValue());
+      if(!(id_stream.is_open() && id_stream.good())) {
+        cerr << "Could not open ID file " << regex_string_arg.getValue() <<
+            endl;
+        return 1;
+      }
+      for(string line; getline(id_stream, line); ) {
+        if(!line.empty() && line.back() == '\r') line.pop_back();
+        if(line.empty()) continue;
+        id_table.insert(StringRef(line));
+      }
+  } else if(regex_in_file) {
+      // Read regex's from file; plain strings among them are matched
+      // together by one automaton and the rest by one DFA, instead of one
+      // regex at a time.
       ifstream regex_stream(regex_string_arg.getValue());
       if(!(regex_stream.is_open() && regex_stream.good())) {
         cerr << "Could not open regex file " << regex_string_arg.getValue() <<
@@ -107,196 +575,60 @@ int main(int argc, char * argv[]) {
         return 1;
       }
       for(string line; getline(regex_stream, line); ) {
-        regex regex_pattern(line, regex_flags);
-        regex_patterns.push_back(regex_pattern);
+        patterns.add(line);
       }
   } else {
-    regex regex_pattern(regex_string_arg.getValue(), regex_flags);
-    regex_patterns.push_back(regex_pattern);
-  } // End regex setup
+    patterns.add(regex_string_arg.getValue());
+  }
+  IdsLeft ids_left(id_table.size());
+  // End regex setup
 
   // Translation frame setup
-  TranslationFrames tframe;
-  switch(frame) {
-  case 0:
-    tframe = SINGLE_FRAME;
-    break;
-  case 1:
-    tframe = WITH_REVERSE_COMPLEMENT;
-    break;
-  case 2:
-    tframe = WITH_FRAME_SHIFTS;
-    break;
-  case 3:
-    tframe = SIX_FRAME;
-    break;
-  default:
-    tframe = SINGLE_FRAME;
-    break;
-  } // End translation frame setup
-
-  // Output file setup
-  SeqFileOut out_handle(cout, Fasta());
-  if(format == "fasta") {
-    setFormat(out_handle, Fasta());
-  } else if(format == "fastq") {
-    setFormat(out_handle, Fastq());
-  } else {
+  vector<ReadingFrame> frames = Translator::frames(frame);
+
+  if(format != "fasta" && format != "fastq") {
     cerr << "Unrecognized output format";
     return 1;
-  } // End output file setup
-
-  // Loop variables
-  CharString id;
-  CharString seq;              // CharString more flexible than Dna5String
-  CharString qual;
-  SeqFileInWrapper seq_handle;
-
-  // Loop over input files
-  int nmatched = 0;
-  for(string& infile: infiles) {
-
-    try {
-        seq_handle.open(infile);
-    } catch(Exception const &e) {
-      cerr << "Could not open " << infile << endl;
-      seq_handle.close();
-      return 1;
-    }
- 
-    bool matched = false;
-    while(!seq_handle.atEnd()) {
-
-      try {
-
-        readRecord(id, seq, qual, seq_handle.sqh);
-      } catch (Exception const &e) {
-
-        cerr << "Error: " << e.what() << endl;
-        seq_handle.close();
-        close(out_handle);
-        return 1;
-
-      } // End try-catch for record reading.
-
-
-      // Loop over patterns
-      matched = false;
-      for(regex rg: regex_patterns) {
-
-         // Regex
-         if(seq_regex) {
-  
-           if(regex_search(match_type, regex("a"))) {
-             match_type = "frcR";
-           }
-           if(regex_search(match_type, regex("A"))) {
-             match_type = "frcRt";
-           }
-  
-           // Due to some quirks of Seqan, I have to do a number of format
-           // conversions, so this isn't as elegant as I would like.
-           // Also this assumes DNA, not RNA, even though RNA could work
-           // fine. Note that any type of sequence will work with regular
-           // forward matching.
-           for(char& c: match_type) {
-             switch (c) {
-             case 'f':
-               {
-                 CharString _seq = seq;
-                 matched |= regex_search(toCString(_seq), rg,
-                                         regex_match_flags);
-                 break;
-               }
-             case 'r':
-               {
-                 ModifiedString<CharString, ModReverse> rseq(seq);
-                 CharString _seq(rseq);
-                 matched |= regex_search(toCString(_seq), rg,
-                                         regex_match_flags);
-                 break;
-               }
-             case 'c':
-               {
-                 Dna5String dseq(seq);
-                 complement(dseq);
-                 CharString _seq(dseq);
-                 matched |= regex_search(toCString(_seq), rg,
-                                         regex_match_flags);
-                 break;
-               }
-              case 'R':
-               {
-                 Dna5String dseq(seq);
-                 reverseComplement(dseq);
-                 CharString _seq(dseq);
-                 matched |= regex_search(toCString(_seq), rg,
-                                         regex_match_flags);
-                 break;
-               }
-             case 't':
-               {
-                 // template<typename T> trans_search(seq, pattern) ... 
-                 // use with <Dna5String> for DNA or <Rna5String>...
-                 StringSet< String<AminoAcid> > aseqs;
-                 Dna5String dseq(seq);
-                 translate(aseqs, dseq, tframe);
-                 // Loop over translation frames
-                 for(String<AminoAcid>& _aseq: aseqs) {
-                   CharString _seq(_aseq);
-                   matched |= regex_search(toCString(_seq), rg,
-                                          regex_match_flags);
-                } // End loop over translation frames
-                break;
-              }
-
-            } // End switch statement
-
-          } // End match_type loop
-
-        } else {
-
-          // Simple regex on sequence IDs
-          matched = regex_search(toCString(id), rg,
-                                 regex_match_flags);
-
-        } // End regex if/else
-
-         // If a match was found, no need to check the rest of the
-         // regex patterns:
-         if(matched) break;
-
-      } // End loop over regex pattern
-
-      // Write out if matched
-      if((matched && !inverted) || (!matched && inverted)) {
-        nmatched++;
-        try {
-            writeRecord(out_handle, id, seq, qual);
-        } catch (Exception const &e) {
-            cerr << "Error: " << e.what() << endl;
-            cerr << "Error writing output" << endl;
-            seq_handle.close();
-            return 1;
-        }
-      } // End write out if matched
+  }
 
-      
-    } // End single file reading loop
+  MatchPlan plan(patterns, seq_regex, match_type, frames);
+  try {
+    plan.compile();
+  } catch(Exception const &e) {
+    cerr << "Error: " << e.what() << endl;
+    return 1;
+  }
 
-    
-    // Close the input handle and check for errors
-    if(!seq_handle.close()) {
-        cerr << "Problem closing " << infile << endl;
-        close(out_handle);
-        return 1;
+  // -x lookups are cheaper than reading the records, so threads would
+  // only help for pattern matching.
+  if(nthreads > 1 && !exact_ids) {
+    SeqFileOut out_handle(cout, Fasta());
+    if(format == "fastq") {
+      setFormat(out_handle, Fastq());
     }
+    int nmatched = 0;
+    bool ok = grepThreaded(infiles, plan, inverted, nthreads, ordered,
+                           out_handle, nmatched);
+    close(out_handle);
+    if(!ok) return 1;
+    return nmatched ? 0 : 1;
+  }
 
-  } // End loop over files
-
-  close(out_handle);
-
-  if(nmatched) {
+  GrepTotals totals;
+  int status = runFileJobs(infiles.size(), njobs,
+                           [&](size_t i, ostream &out, ostream &err) {
+    return grepFile(infiles[i], plan, format, exact_ids, id_table, id_key,
+                    until_found ? &ids_left : nullptr, inverted, out, err,
+                    totals);
+  });
+  if(status != 0) return status;
+
+#ifdef BLTOOLS_DEBUG_ALLOCS
+  cerr << "Allocations while matching " << totals.nrecords << " records: " <<
+    totals.match_allocs << endl;
+#endif
+
+  if(totals.nmatched) {
     return 0;
   } else {
     return 1;
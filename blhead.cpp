@@ -4,6 +4,7 @@
  */
 
 #include <iostream>
+#include <memory>
 #include <queue>
 #include <string>
 #include <vector>
@@ -12,6 +13,9 @@
 
 #include <tclap/CmdLine.h>
 
+#include <BgzfOutput.h>
+#include <FileJobs.h>
+#include <RecordRing.h>
 #include <SeqFileInWrapper.h>
 
 using std::cerr;
@@ -20,6 +24,7 @@ using std::cout;
 using std::endl;
 using std::ifstream;
 using std::istream;
+using std::ostream;
 using std::queue;
 using std::string;
 using std::vector;
@@ -27,35 +32,14 @@ using std::vector;
 using namespace seqan;
 using namespace bltools;
 
-int main(int argc, char * argv[]) {
-  
-  TCLAP::CmdLine cmd("Equivalent of `head' for sequence files", ' ', "0.0");
-  TCLAP::ValueArg<string> format_arg("o", "output-format",
-                                     "Output format: fasta or fastq; fasta is default",
-                                     false, "fasta", "fast[aq]", cmd);
-  TCLAP::ValueArg<int> nlines_arg("n", "lines",
-                                  "print the first n lines of each file",
-                                  false, 10, "int", cmd);
-  TCLAP::UnlabeledMultiArg<string> files("FILE(s)", "filenames", false,
-                                         "file name(s)", cmd, false);
-  cmd.parse(argc, argv);
-  string format = format_arg.getValue();
-  vector<string> infiles = files.getValue();
-  if(infiles.size() == 0) infiles.push_back("-");
-  int nlines = nlines_arg.getValue();
-  unsigned look_ahead = 0;
-  if(nlines < 0) {
-    look_ahead = -1 * nlines;
-  }
-  
-  SeqFileOut out_handle(cout, Fasta());
-  if(format == "fasta") {
-    setFormat(out_handle, Fasta());
-  } else if(format == "fastq") {
+// Print the head of one file to out, with errors going to err.
+// Returns the exit status.
+static int headFile(string &infile, const string &format, int nlines,
+                    unsigned look_ahead, ostream &out, ostream &err) {
+
+  SeqFileOut out_handle(out, Fasta());
+  if(format == "fastq") {
     setFormat(out_handle, Fastq());
-  } else {
-    cerr << "Unrecognized output format";
-    return 1;
   }
 
   CharString id;
@@ -64,68 +48,130 @@ int main(int argc, char * argv[]) {
   queue<CharString> seqs;
   CharString qual;
   queue<CharString> quals;
+  RecordView rec;
   SeqFileInWrapper seq_handle;
 
-  for(string& infile: infiles) {
+  try {
+      seq_handle.open(infile);
+  } catch(Exception const &e) {
+    err << "Could not open " << infile << endl;
+    seq_handle.close();
+    return 1;
+  }
+  
+  int nrecs_read = 0;
+  // Fill up seqs, quals, ids until look_ahead is reached, then for
+  // every additional record, pop one off of seqs, quals, and ids, and
+  // push the new one on until the end of the file is reached.
+  //
+  // For mapped files the look-ahead only holds record offsets; a record
+  // is read again from its offset when it falls out of the ring.
+  bool by_offset = seq_handle.isMapped() && look_ahead > 0;
+  RecordRing ring(look_ahead);
+  while(!seq_handle.atEnd() && ((look_ahead == 0 && nrecs_read < nlines) || look_ahead > 0)) {
 
     try {
-        seq_handle.open(infile);
-    } catch(Exception const &e) {
-      cerr << "Could not open " << infile << endl;
-      seq_handle.close();
-      return 1;
-    }
-    
-    int nrecs_read = 0;
-    // Fill up seqs, quals, ids until look_ahead is reached, then for
-    // every additional record, pop one off of seqs, quals, and ids, and
-    // push the new one on until the end of the file is reached.
-    while(!seq_handle.atEnd() && ((look_ahead == 0 && nrecs_read < nlines) || look_ahead > 0)) {
-
-      try {
-
-        readRecord(id, seq, qual, seq_handle.sqh);
 
-      } catch (Exception const &e) {
+      if(by_offset) {
+        seq_handle.readRecord(rec);
+        RecordSpan evicted;
+        if(!ring.push({rec.offset, rec.length}, evicted)) {
+          continue;
+        }
+        size_t here = seq_handle.tell();
+        seq_handle.seek(evicted.offset);
+        seq_handle.readRecord(id, seq, qual);
+        seq_handle.seek(here);
+      } else {
+        seq_handle.readRecord(id, seq, qual);
+      }
 
-        cerr << "Error: " << e.what() << endl;
-        seq_handle.close();
-        close(out_handle);
-        return 1;
+    } catch (Exception const &e) {
 
-      } // End try-catch for record reading.
+      err << "Error: " << e.what() << endl;
+      seq_handle.close();
+      close(out_handle);
+      return 1;
 
+    } // End try-catch for record reading.
 
-      if(look_ahead > 0) {
-        seqs.push(seq); ids.push(id); quals.push(qual);
-        if(seqs.size() > look_ahead) {
-          id = ids.front(); seq = seqs.front(); qual = quals.front();
-          ids.pop(); seqs.pop(); quals.pop();
-        } else {
-          continue;
-        }
-      }
 
-      // Write output
-      try {
-        writeRecord(out_handle, id, seq, qual);
-        nrecs_read++;
-      } catch (Exception const &e) {
-        cerr << "Error writing output";
-        seq_handle.close();
-        return 1;
+    if(look_ahead > 0 && !by_offset) {
+      seqs.push(seq); ids.push(id); quals.push(qual);
+      if(seqs.size() > look_ahead) {
+        id = ids.front(); seq = seqs.front(); qual = quals.front();
+        ids.pop(); seqs.pop(); quals.pop();
+      } else {
+        continue;
       }
-      
-    } // End single file reading loop
+    }
 
-    if(!seq_handle.close()) {
-        cerr << "Problem closing " << infile << endl;
-        close(out_handle);
-        return 1;
+    // Write output
+    try {
+      writeRecord(out_handle, id, seq, qual);
+      nrecs_read++;
+    } catch (Exception const &e) {
+      err << "Error writing output";
+      seq_handle.close();
+      return 1;
     }
+    
+  } // End single file reading loop
 
-  } // End loop over files
+  if(!seq_handle.close()) {
+      err << "Problem closing " << infile << endl;
+      close(out_handle);
+      return 1;
+  }
   close(out_handle);
 
   return 0;
 }
+
+int main(int argc, char * argv[]) {
+  
+  TCLAP::CmdLine cmd("Equivalent of `head' for sequence files", ' ', "0.0");
+  TCLAP::ValueArg<string> format_arg("o", "output-format",
+                                     "Output format: fasta or fastq; fasta is default",
+                                     false, "fasta", "fast[aq]", cmd);
+  TCLAP::ValueArg<int> nlines_arg("n", "lines",
+                                  "print the first n lines of each file",
+                                  false, 10, "int", cmd);
+  TCLAP::ValueArg<unsigned> jobs_arg("j", "jobs",
+                                     "Number of files to read at once",
+                                     false, 1, "int", cmd);
+  TCLAP::SwitchArg bgzf_arg("z", "bgzf",
+                            "Compress the output as BGZF (readable as gzip)",
+                            cmd);
+  TCLAP::ValueArg<string> gzi_arg("", "gzi",
+                                  "With -z, also write a .gzi index of the output to this file",
+                                  false, "", "file", cmd);
+  TCLAP::UnlabeledMultiArg<string> files("FILE(s)", "filenames", false,
+                                         "file name(s)", cmd, false);
+  cmd.parse(argc, argv);
+  string format = format_arg.getValue();
+  unsigned njobs = jobs_arg.getValue();
+  vector<string> infiles = files.getValue();
+  if(infiles.size() == 0) infiles.push_back("-");
+  int nlines = nlines_arg.getValue();
+  unsigned look_ahead = 0;
+  if(nlines < 0) {
+    look_ahead = -1 * nlines;
+  }
+  
+  if(format != "fasta" && format != "fastq") {
+    cerr << "Unrecognized output format";
+    return 1;
+  }
+  std::unique_ptr<BgzfCout> compressed;    // With -z, until main returns
+  if(!compressCout(bgzf_arg.getValue(), gzi_arg.getValue(), compressed)) {
+    return 1;
+  }
+
+  int status = runFileJobs(infiles.size(), njobs,
+                           [&](size_t i, ostream &out, ostream &err) {
+    return headFile(infiles[i], format, nlines, look_ahead, out, err);
+  });
+
+  return status;
+}
@@ -12,18 +12,45 @@
  * the size of the first record in each file. However, the ends of the
  * sequences are padded to even up the length.
  *
+ * Joined sequences are kept in a JoinTable (a hash of IDs to rows, with
+ * the sequence data in an arena), which only spells out the padding as
+ * rows are written. They are written sorted by ID, or in the order IDs
+ * first appear with -k.
+ *
+ * With -j the files are read by a pool of threads, each file into its
+ * own FileLoad (views into the file's mapping where possible, copies
+ * otherwise), and joined on the main thread strictly in command-line
+ * order, so the output, warnings and errors are the same as reading
+ * them one at a time. Only a few loaded files are held at once.
+ *
+ * With -S the files must already be sorted by ID, and are merged by a
+ * MergeJoin instead: each joined record is written as soon as it is
+ * complete, so nothing like the whole alignment is held in memory. All
+ * the files are open at once, and the first record of each must not be
+ * empty, since it gives the file's padding length.
+ *
  */
 
+#include <atomic>
+#include <cstdint>
+#include <exception>
 #include <iostream>
-#include <map>
-#include <set>
+#include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <seqan/seq_io.h>
 
 #include <tclap/CmdLine.h>
 
+#include <Arena.h>
+#include <BgzfOutput.h>
+#include <BoundedQueue.h>
+#include <IdKey.h>
+#include <JoinTable.h>
+#include <MergeJoin.h>
+#include <ReorderBuffer.h>
 #include <SeqFileInWrapper.h>
 
 using std::cerr;
@@ -32,38 +59,203 @@ using std::cout;
 using std::endl;
 using std::ifstream;
 using std::istream;
-using std::map;
-using std::pair;
-using std::set;
 using std::string;
 using std::vector;
 
 using namespace seqan;
 using namespace bltools;
 
-vector<string> split(string s, string delim) {
-    vector<string> ret;
-    string buffer = "";
-    bool delim_already_seen = false;
-    string current_token = "";
-    for(const char& c: s) {
-        for(const char& d: delim) {
-            if(c == d) {
-                if(!delim_already_seen) {
-                    ret.push_back(current_token);
-                    current_token = "";
-                }
-                delim_already_seen = true;
-            } else {
-                delim_already_seen = false;
-                current_token += c;
-            }
-        }
+// One input file, read but not yet joined. Exceptions from opening or
+// reading it are kept, and rethrown when the file is joined, so they are
+// handled just where they would be if the file were read then.
+struct FileLoad {
+  struct Record {
+    StringRef id;
+    StringRef seq;
+    StringRef key;             // Slice of id to join on, if has_key
+    bool has_key;
+  };
+
+  size_t number;               // Position on the command line
+  SeqFileInWrapper handle;     // Left open while records point into it
+  bool opened = false;
+  vector<Record> records;
+  Arena copies;                // Fields that aren't in a file mapping
+  std::exception_ptr error;
+
+  void clear() {
+    opened = false;
+    records.clear();
+    copies.clear();
+    error = nullptr;
+  }
+};
+
+// Whether a field of a mapped record lies in the file itself; wrapped
+// sequences are joined in a buffer that the next record reuses
+bool inMapping(const RecordView &rec, const StringRef &field) {
+  const char * start = rec.id.data - 1;
+  return field.data >= start && field.data + field.size <= start + rec.length;
+}
+
+// Read infile into load, which must be clear
+void loadFile(string &infile, const IdKey &id_key, FileLoad &load) {
+  try {
+    load.handle.open(infile);
+  } catch(...) {
+    load.error = std::current_exception();
+    return;
+  }
+  load.opened = true;
+
+  bool mapped = load.handle.isMapped();
+  RecordView rec;
+  try {
+    while(!load.handle.atEnd()) {
+      load.handle.readRecord(rec);
+      FileLoad::Record r;
+      r.id = rec.id;
+      r.seq = rec.seq;
+      if(!mapped) {
+        r.id = StringRef(load.copies.copy(rec.id.data, rec.id.size), rec.id.size);
+      }
+      if(!mapped || !inMapping(rec, rec.seq)) {
+        r.seq = StringRef(load.copies.copy(rec.seq.data, rec.seq.size),
+                          rec.seq.size);
+      }
+      r.has_key = id_key.extract(r.id, r.key);
+      load.records.push_back(r);
+    }
+  } catch(...) {
+    load.error = std::current_exception();
+  }
+}
+
+// Add a loaded file to the joined sequences, with the same messages as
+// reading it record by record. Returns non-zero if the file couldn't be
+// opened, read or closed.
+int joinFile(string &infile, FileLoad &load, JoinTable &seqs,
+             bool allow_dups) {
+
+  if(!load.opened) {
+    try {
+      std::rethrow_exception(load.error);
+    } catch(Exception const &e) {
+      cerr << "Could not open " << infile << endl;
+      load.handle.close();
+      return 1;
+    }
+  }
+
+  unsigned long seq_size = 0;     // size of the first record in the file
+  for(const FileLoad::Record &rec: load.records) {
+
+    // Check the size of the first sequence in the file
+    if(seq_size == 0) {
+      seq_size = rec.seq.size;
+      seqs.noteLength(seq_size);
+    }
+
+    if(seq_size != rec.seq.size) {
+      cerr << "Warning " << rec.id << " is not the same size as other seqs"
+           << " in the same file " << seq_size << " " <<
+          rec.seq.size << endl;
+    }
+
+    // Join on the whole ID or a field of it (as a slice of the header;
+    // case is folded by the table). If the field is not found in this
+    // record, skip it.
+    if(!rec.has_key) continue;
+
+    // Check if this ID has been processed yet
+    bool is_new;
+    uint32_t row = seqs.insert(rec.key, is_new);
+    if(!is_new && seqs.inCurrentFile(row) && !allow_dups) {
+        cerr << seqs.id(row) << " found more than once in " << infile << endl;
+        throw("Duplicated ID");
     }
-    if(!delim_already_seen) {
-        ret.push_back(current_token);
+
+    // Add the current sequence, after the padding for any files the ID
+    // was missing from
+    seqs.addRecord(row, is_new, rec.seq);
+
+  } // End loop over records
+
+  if(load.error) {
+    try {
+      std::rethrow_exception(load.error);
+    } catch (Exception const &e) {
+      cerr << "Error: " << e.what() << endl;
+      load.handle.close();
+      return 1;
     }
-    return ret;
+  }
+
+  // IDs missing from this file are padded when they're written
+  seqs.endFile(seq_size);
+
+  if(!load.handle.close()) {
+      cerr << "Problem closing " << infile << endl;
+      return 1;
+  }
+  return 0;
+}
+
+// -j: njobs threads load files while this one joins them in order.
+// Each thread takes a free FileLoad before the next file number, so the
+// file to be joined next always has one; the pool bounds how far ahead
+// loading can get.
+int joinFiles(vector<string> &infiles, const IdKey &id_key, unsigned njobs,
+              JoinTable &seqs, bool allow_dups) {
+
+  if(njobs < 2 || infiles.size() < 2) {
+    FileLoad load;
+    for(size_t i = 0; i < infiles.size(); i++) {
+      loadFile(infiles[i], id_key, load);
+      int status = joinFile(infiles[i], load, seqs, allow_dups);
+      if(status != 0) return status;
+      load.clear();
+    }
+    return 0;
+  }
+
+  vector<FileLoad> pool(2 * njobs + 2);
+  BoundedQueue<FileLoad *> free_loads(pool.size());
+  BoundedQueue<FileLoad *> loaded(pool.size());
+  for(FileLoad &l: pool) free_loads.push(&l);
+  std::atomic<size_t> next_file(0);
+  std::atomic<unsigned> running(njobs);
+
+  vector<std::thread> workers;
+  for(unsigned t = 0; t < njobs; t++) {
+    workers.emplace_back([&]() {
+      FileLoad * l;
+      while(free_loads.pop(l)) {
+        size_t i = next_file++;
+        if(i >= infiles.size()) break;
+        l->number = i;
+        loadFile(infiles[i], id_key, *l);
+        loaded.push(l);
+      }
+      if(--running == 0) loaded.close();
+    });
+  }
+
+  // Files that arrive early wait until their turn
+  ReorderBuffer<FileLoad *> waiting;
+  int status = 0;
+  FileLoad * l;
+  while(status == 0 && waiting.next() < infiles.size() && loaded.pop(l)) {
+    waiting.add(l->number, l);
+    while(status == 0 && waiting.pop(l)) {
+      status = joinFile(infiles[l->number], *l, seqs, allow_dups);
+      l->clear();
+      free_loads.push(l);
+    }
+  }
+  free_loads.close();
+  for(std::thread &t: workers) t.join();
+  return status;
 }
 
 int main(int argc, char * argv[]) {
@@ -87,6 +279,21 @@ int main(int argc, char * argv[]) {
   TCLAP::ValueArg<string> separator_arg("s", "separator",
                                         "Separator between joined sequences",
                                         false, "", "string", cmd);
+  TCLAP::SwitchArg keep_order_arg("k", "keep-order",
+                                  "Write records in the order their IDs first appear instead of sorted by ID",
+                                  cmd);
+  TCLAP::ValueArg<unsigned> jobs_arg("j", "jobs",
+                                     "Number of files to read at once; not used with -S",
+                                     false, 1, "int", cmd);
+  TCLAP::SwitchArg sorted_arg("S", "sorted",
+                              "Input files are sorted by ID (bytewise); join them as they are read instead of in memory",
+                              cmd);
+  TCLAP::SwitchArg bgzf_arg("z", "bgzf",
+                            "Compress the output as BGZF (readable as gzip)",
+                            cmd);
+  TCLAP::ValueArg<string> gzi_arg("", "gzi",
+                                  "With -z, also write a .gzi index of the output to this file",
+                                  false, "", "file", cmd);
   TCLAP::UnlabeledMultiArg<string> files("FILE(s)", "filenames", false,
                                          "file name(s)", cmd, false);
   cmd.parse(argc, argv);
@@ -97,148 +304,48 @@ int main(int argc, char * argv[]) {
   string delim = delim_arg.getValue();
   string pad_char = pad_char_arg.getValue();
   string separator = separator_arg.getValue();
+  bool keep_order = keep_order_arg.getValue();
+  bool sorted = sorted_arg.getValue();
+  unsigned njobs = jobs_arg.getValue();
   vector<string> infiles = files.getValue();
   if(infiles.size() == 0) infiles.push_back("-");
+  IdKey id_key(field, delim);
+  if(sorted && keep_order) {
+    cerr << "-S and -k can't be used together" << endl;
+    return 1;
+  }
+  std::unique_ptr<BgzfCout> compressed;    // With -z, until main returns
+  if(!compressCout(bgzf_arg.getValue(), gzi_arg.getValue(), compressed)) {
+    return 1;
+  }
 
-  CharString id;
-  CharString seq_;              // CharString more flexible than Dna5String
-  string seq;
-  SeqFileInWrapper seq_handle;
-  map<string, string> seqs;       // seqs[ID] = joined sequence string
-  std::set<string> seqs_in_file;  // for each file, keep track of IDs seen
-  unsigned long total_bases = 0;  // total length of joined sequences
-  unsigned long seq_size = 0;     // size of the first record in each file
-  unsigned long nfiles = 0;       // number of files processed
-  vector<unsigned long> seq_lengths;
-
-  for(string& infile: infiles) {
-    
-    seq_size = 0;
-    seqs_in_file.clear();
-
+  if(sorted) {
+    MergeJoin merge(pad_char, separator, !no_pad, allow_dups, id_key,
+                    ignore_case);
     try {
-        seq_handle.open(infile);
+      merge.run(infiles, cout, cerr);
     } catch(Exception const &e) {
-      cerr << "Could not open " << infile << endl;
-      seq_handle.close();
+      cerr << "Error: " << e.what() << endl;
       return 1;
     }
-    
-    while(!seq_handle.atEnd()) {
-
-      try {
-
-        readRecord(id, seq_, seq_handle.sqh);
-        //nrecs_read++; 
-
-      } catch (Exception const &e) {
-
-        cerr << "Error: " << e.what() << endl;
-        seq_handle.close();
-        return 1;
-
-      } // End try-catch for record reading.
-      
-      // Check the size of the first sequence in the file
-      if(seq_size == 0) {
-        seq_size = length(seq_);
-        seq_lengths.push_back(seq_size);
-      }
-
-      if(seq_size != length(seq_)) {
-        cerr << "Warning " << id << " is not the same size as other seqs"
-             << " in the same file " << seq_size << " " <<
-            length(seq_) << endl;
-      }
-      
-      seq = string(toCString(seq_));
-      
-      // Simple method: just use the whole sequence ID to join
-      string join_id = string(toCString(id));
-
-      // Fancier: use parts of the ID
-      if(ignore_case) {
-        // Convert to upper case
-        for(unsigned jii = 0; jii < join_id.size(); jii++) {
-            join_id.at(jii) = toupper(join_id.at(jii));
-        }
-      }
-      if(field > 0) {
-        vector<string> splitted = split(join_id, delim);
-        if(splitted.size() < field) {
-          // If the field is not found in this record, skip it
-          continue;
-        }
-        join_id = splitted[field-1];
-      }
-
-
-      // Check if this ID has been processed yet
-      std::set<string>::iterator its = seqs_in_file.find(join_id);
-      if(its != seqs_in_file.end() && !allow_dups) {
-          cerr << join_id << " found more than once in " << infile << endl;
-          throw("Duplicated ID");
-      }
-      seqs_in_file.insert(join_id);
-
-      // Test if id is in map, and add if not
-      // Also add enough sequence to fill in missed sequences
-      map<string, string>::iterator it = seqs.find(join_id);
-      if(it != seqs.end()) {
-        // Found: do nothing except add padding
-        if(nfiles > 0) {
-            seqs[join_id] += separator;
-        }
-      } else {
-        if(total_bases > 0 && !no_pad) {
-          seqs[join_id].reserve(total_bases + seq_size * 2);
-          for(unsigned long si = 0; si < seq_lengths.size()-1; si++) {
-            unsigned long sl = seq_lengths[si];
-            for(unsigned long j = 0; j < sl; j++) {
-              seqs[join_id] += pad_char;
-            }
-            seqs[join_id] += separator;
-          }
-        } else {
-          seqs[join_id] = "";
-        }
-      } // End test for existence of ID
-      
-      // Add the current sequence
-      seqs[join_id] += seq;
-      
-    } // End single file reading loop
-    
-    total_bases += seq_size;
-    
-    // Add padding to IDs found in previous files but not this one
-    if(!no_pad) {
-      unsigned long target_length = total_bases + separator.size() * nfiles;
-      for(map<string, string>::iterator it = seqs.begin(); it != seqs.end(); it++) {
-        if(it->second.length() < target_length) {
-          if(nfiles > 0) {
-            it->second += separator;
-          }
-          for(unsigned long j = it->second.length(); j < target_length; j++) {
-            it->second += pad_char;
-          }
-        }
-      }
-    }
-
-    if(!seq_handle.close()) {
-        cerr << "Problem closing " << infile << endl;
-        return 1;
-    }
+    return 0;
+  }
 
-    nfiles++;
+  JoinTable seqs(pad_char, separator, !no_pad, ignore_case);  // Joined sequence for each ID
+  int status = joinFiles(infiles, id_key, njobs, seqs, allow_dups);
+  if(status != 0) return status;
 
-  } // End loop over files
-  
   // Write the output in fasta format
-  for(pair<string, string> item: seqs) {
-    cout << ">" << item.first << endl;
-    cout << item.second << endl;
+  vector<uint32_t> order;
+  if(keep_order) {
+    for(uint32_t row = 0; row < seqs.size(); row++) order.push_back(row);
+  } else {
+    order = seqs.sortedRows();
+  }
+  for(uint32_t row: order) {
+    cout << ">" << seqs.id(row) << endl;
+    seqs.write(cout, row);
+    cout << endl;
   }
 
   return 0;
@@ -4,6 +4,7 @@
  */
 
 #include <iostream>
+#include <memory>
 #include <queue>
 #include <string>
 #include <vector>
@@ -12,6 +13,9 @@
 
 #include <tclap/CmdLine.h>
 
+#include <BgzfOutput.h>
+#include <FileJobs.h>
+#include <RecordRing.h>
 #include <SeqFileInWrapper.h>
 
 using std::cerr;
@@ -20,6 +24,7 @@ using std::cout;
 using std::endl;
 using std::ifstream;
 using std::istream;
+using std::ostream;
 using std::queue;
 using std::stoi;
 using std::string;
@@ -28,6 +33,149 @@ using std::vector;
 using namespace seqan;
 using namespace bltools;
 
+// Print the tail of one file to out, with errors going to err.
+// Returns the exit status.
+static int tailFile(string &infile, const string &format, int nlines,
+                    int nskip, ostream &out, ostream &err) {
+
+  SeqFileOut out_handle(out, Fasta());
+  if(format == "fastq") {
+    setFormat(out_handle, Fastq());
+  }
+
+  CharString id;
+  queue<CharString> ids;
+  CharString seq;              // CharString more flexible than Dna5String
+  queue<CharString> seqs;
+  CharString qual;
+  queue<CharString> quals;
+  RecordView rec;
+  SeqFileInWrapper seq_handle;
+
+  try {
+    seq_handle.open(infile);
+  } catch(Exception const &e) {
+    err << "Could not open " << infile << endl;
+    seq_handle.close();
+    return 1;
+  }
+  
+  int nrecs_read = 0;
+
+  // With an index, jump straight to the first record that will be
+  // printed instead of reading everything before it. Without one, a
+  // mapped file can still be scanned backwards from the end to find the
+  // last nlines records.
+  if(seq_handle.loadIndex()) {
+    size_t nrecs = seq_handle.recordCount();
+    if(nskip > 0) {
+      seq_handle.seekRecord(nskip - 1);
+      nrecs_read = nskip - 1;
+    } else if(nrecs > (size_t) nlines) {
+      seq_handle.seekRecord(nrecs - nlines);
+    }
+  } else if(nskip == 0) {
+    seq_handle.seekTail(nlines);
+  }
+
+  // Mapped files only keep the offsets of the last nlines records and
+  // read them again at the end; streams have to keep copies.
+  bool by_offset = seq_handle.isMapped() && nskip == 0;
+  RecordRing ring(nlines);
+
+  // Fill up seqs, quals, ids until look_ahead is reached, then for
+  // every additional record, pop one off of seqs, quals, and ids, and
+  // push the new one on until the end of the file is reached.
+  while(!seq_handle.atEnd()) {
+
+    try {
+
+      if(by_offset) {
+        seq_handle.readRecord(rec);
+      } else {
+        seq_handle.readRecord(id, seq, qual);
+      }
+      nrecs_read++;
+
+    } catch (Exception const &e) {
+
+      err << "Error: " << e.what() << endl;
+      seq_handle.close();
+      close(out_handle);
+      return 1;
+
+    } // End try-catch for record reading.
+
+    // If nskip > 0, just continue until nrecs_read > nskip, then write
+    // output as file is read.
+    //
+    // Otherwise, keep pushing to the queue (after queue.size() == nlines,
+    // also pop a record each time). Then, after the while loop, write all
+    // the records in the queue.
+    
+    if(nskip > 0) {
+      if(nrecs_read >= nskip) {
+        try {
+          writeRecord(out_handle, id, seq, qual);
+        } catch (Exception const &e) {
+          err << "Error writing output";
+          seq_handle.close();
+          return 1;
+        }
+      } else {
+        continue;
+      }
+    } // End if(nskip > 0)
+    else if(nlines > 0 && by_offset) {
+      ring.push({rec.offset, rec.length});
+    }
+    else if(nlines > 0) {
+      seqs.push(seq); ids.push(id); quals.push(qual);
+      if(seqs.size() > (unsigned) nlines) {
+        ids.pop(); seqs.pop(); quals.pop();
+      }
+    } // End if(nlines > 0)
+
+  } // End single file reading loop
+  
+  // Write output if nlines > 0
+  // Can we do for(StringChar id: ids; StringChar seq:seqs...)?
+  if(nlines > 0 && by_offset) {
+    for(size_t i = 0; i < ring.size(); i++) {
+      try {
+        seq_handle.seek(ring[i].offset);
+        seq_handle.readRecord(id, seq, qual);
+        writeRecord(out_handle, id, seq, qual);
+      } catch (Exception const &e) {
+        err << "Error writing output";
+        seq_handle.close();
+        return 1;
+      }
+    }
+  } else if(nlines > 0) {
+    while(!ids.empty()) {
+      try {
+        writeRecord(out_handle, ids.front(), seqs.front(),
+                    quals.front());
+        ids.pop(); seqs.pop(); quals.pop();
+      } catch (Exception const &e) {
+        err << "Error writing output";
+        seq_handle.close();
+        return 1;
+      }
+    }
+  }
+
+  if(!seq_handle.close()) {
+    err << "Problem closing " << infile << endl;
+    close(out_handle);
+    return 1;
+  }
+  close(out_handle);
+
+  return 0;
+}
+
 int main(int argc, char * argv[]) {
   
   TCLAP::CmdLine cmd("Equivalent of `tail' for sequence files", ' ', "0.0");
@@ -37,10 +185,20 @@ int main(int argc, char * argv[]) {
   TCLAP::ValueArg<string> nlines_arg("n", "lines",
                                      "print the last n lines of each file or all lines but the first +n",
                                      false, "10", "[+]int", cmd);
+  TCLAP::ValueArg<unsigned> jobs_arg("j", "jobs",
+                                     "Number of files to read at once",
+                                     false, 1, "int", cmd);
+  TCLAP::SwitchArg bgzf_arg("z", "bgzf",
+                            "Compress the output as BGZF (readable as gzip)",
+                            cmd);
+  TCLAP::ValueArg<string> gzi_arg("", "gzi",
+                                  "With -z, also write a .gzi index of the output to this file",
+                                  false, "", "file", cmd);
   TCLAP::UnlabeledMultiArg<string> files("FILE(s)", "filenames", false,
                                          "file name(s)", cmd, false);
   cmd.parse(argc, argv);
   string format = format_arg.getValue();
+  unsigned njobs = jobs_arg.getValue();
   vector<string> infiles = files.getValue();
   if(infiles.size() == 0) infiles.push_back("-");
   string nlines_string = nlines_arg.getValue();
@@ -59,107 +217,19 @@ int main(int argc, char * argv[]) {
     return 1;
   }
   
-  SeqFileOut out_handle(cout, Fasta());
-  if(format == "fasta") {
-    setFormat(out_handle, Fasta());
-  } else if(format == "fastq") {
-    setFormat(out_handle, Fastq());
-  } else {
+  if(format != "fasta" && format != "fastq") {
     cerr << "Unrecognized output format";
     return 1;
   }
+  std::unique_ptr<BgzfCout> compressed;    // With -z, until main returns
+  if(!compressCout(bgzf_arg.getValue(), gzi_arg.getValue(), compressed)) {
+    return 1;
+  }
 
-  CharString id;
-  queue<CharString> ids;
-  CharString seq;              // CharString more flexible than Dna5String
-  queue<CharString> seqs;
-  CharString qual;
-  queue<CharString> quals;
-  SeqFileInWrapper seq_handle;
-
-  for(string& infile: infiles) {
-
-    try {
-      seq_handle.open(infile);
-    } catch(Exception const &e) {
-      cerr << "Could not open " << infile << endl;
-      seq_handle.close();
-      return 1;
-    }
-    
-    int nrecs_read = 0;
-    // Fill up seqs, quals, ids until look_ahead is reached, then for
-    // every additional record, pop one off of seqs, quals, and ids, and
-    // push the new one on until the end of the file is reached.
-    while(!seq_handle.atEnd()) {
-
-      try {
-
-        readRecord(id, seq, qual, seq_handle.sqh);
-        nrecs_read++;
-
-      } catch (Exception const &e) {
-
-        cerr << "Error: " << e.what() << endl;
-        seq_handle.close();
-        close(out_handle);
-        return 1;
-
-      } // End try-catch for record reading.
-
-      // If nskip > 0, just continue until nrecs_read > nskip, then write
-      // output as file is read.
-      //
-      // Otherwise, keep pushing to the queue (after queue.size() == nlines,
-      // also pop a record each time). Then, after the while loop, write all
-      // the records in the queue.
-      
-      if(nskip > 0) {
-        if(nrecs_read >= nskip) {
-          try {
-            writeRecord(out_handle, id, seq, qual);
-          } catch (Exception const &e) {
-            cerr << "Error writing output";
-            seq_handle.close();
-            return 1;
-          }
-        } else {
-          continue;
-        }
-      } // End if(nskip > 0)
-      else if(nlines > 0) {
-        seqs.push(seq); ids.push(id); quals.push(qual);
-        if(seqs.size() > (unsigned) nlines) {
-          ids.pop(); seqs.pop(); quals.pop();
-        }
-      } // End if(nlines > 0)
-
-    } // End single file reading loop
-    
-    // Write output if nlines > 0
-    // Can we do for(StringChar id: ids; StringChar seq:seqs...)?
-    if(nlines > 0) {
-      for(int i=0; i < nlines; i++) {
-        try {
-          writeRecord(out_handle, ids.front(), seqs.front(),
-                      quals.front());
-          ids.pop(); seqs.pop(); quals.pop();
-        } catch (Exception const &e) {
-          cerr << "Error writing output";
-          seq_handle.close();
-          return 1;
-        }
-      }
-    }
-
-    if(!seq_handle.close()) {
-      cerr << "Problem closing " << infile << endl;
-      close(out_handle);
-      return 1;
-    }
-
-  } // End loop over files
-  close(out_handle);
+  int status = runFileJobs(infiles.size(), njobs,
+                           [&](size_t i, ostream &out, ostream &err) {
+    return tailFile(infiles[i], format, nlines, nskip, out, err);
+  });
 
-  return 0;
+  return status;
 }
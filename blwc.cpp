@@ -3,16 +3,27 @@
  *
  */
 
+#include <algorithm>
+#include <cstdint>
+#include <exception>
 #include <iostream>
+#include <memory>
 #include <queue>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <seqan/seq_io.h>
 
 #include <tclap/CmdLine.h>
 
+#include <BgzfOutput.h>
+#include <Composition.h>
+#include <FileJobs.h>
+#include <MappedSeqFile.h>
 #include <SeqFileInWrapper.h>
+#include <SeqStats.h>
 
 using std::cerr;
 using std::cin;
@@ -20,13 +31,272 @@ using std::cout;
 using std::endl;
 using std::ifstream;
 using std::istream;
+using std::ostream;
 using std::queue;
+using std::runtime_error;
 using std::string;
 using std::vector;
 
 using namespace seqan;
 using namespace bltools;
 
+// Tab-separated counts in BaseClass order, after whatever is on the line
+static void writeComposition(ostream &out, const Composition &counts) {
+  for(int c = BASE_A; c <= BASE_OTHER; c++) {
+    out << "\t" << counts.counts[c];
+  }
+  out << endl;
+}
+
+// Records, bases, min/max/mean length, N50, L50, GC and gap fractions
+static void writeStats(ostream &out, const string &name,
+                       const SeqStats &stats) {
+  out << name << "\t" << stats.records() << "\t" << stats.bases() << "\t"
+       << stats.minLength() << "\t" << stats.maxLength() << "\t"
+       << stats.meanLength() << "\t" << stats.n50() << "\t"
+       << stats.l50() << "\t" << stats.gcFraction() << "\t"
+       << stats.gapFraction() << endl;
+}
+
+// Smallest piece of a file worth giving a thread of its own
+static const size_t MIN_PIECE_BYTES = 1 << 20;
+
+// What the records starting in one piece of a file add up to
+struct PieceCounts {
+  uint64_t records;
+  Composition counts;
+  SeqStats stats;
+  std::exception_ptr error;
+
+  explicit PieceCounts(bool include_gaps) : records(0), stats(include_gaps) {}
+};
+
+static void countPiece(const string &path, size_t start, size_t stop,
+                       bool headers_only, bool keep_stats, PieceCounts &piece) {
+  try {
+    MappedSeqFile file;
+    if(!file.open(path)) {
+      throw runtime_error("Could not reopen " + path);
+    }
+    file.seek(start);
+    RecordView rec;
+    LazyRecord header;
+    Composition record;
+    while(!file.atEnd() && file.tell() < stop) {
+      if(headers_only) {
+        file.skipRecord(header);
+      } else {
+        file.readRecord(rec);
+        record.clear();
+        record.add(rec.seq.begin(), rec.seq.end());
+        piece.counts += record;
+        if(keep_stats) piece.stats.add(record);
+      }
+      piece.records++;
+    }
+  } catch(...) {
+    piece.error = std::current_exception();
+  }
+}
+
+// -t: split a mapped file at record starts into a piece per thread and
+// count them all at once. False if the file is too small to be worth it
+// or can't be split (wrapped fastq); then it has to be read in order.
+// Throws the error from the first piece that had one.
+static bool countSplit(const string &path, unsigned nthreads,
+                       bool headers_only, bool keep_stats,
+                       uint64_t &nrecs, Composition &counts, SeqStats &stats) {
+  MappedSeqFile file;
+  if(!file.open(path)) return false;
+  size_t npieces = std::min<size_t>(nthreads, file.size() / MIN_PIECE_BYTES);
+  if(npieces < 2) return false;
+
+  vector<size_t> bounds(npieces + 1, file.size());
+  for(size_t i = 0; i < npieces; i++) {
+    if(!file.findRecordStart(i * (file.size() / npieces), bounds[i])) {
+      return false;
+    }
+  }
+  file.close();
+
+  vector<PieceCounts> pieces(npieces, PieceCounts(stats.includeGaps()));
+  vector<std::thread> threads;
+  for(size_t i = 0; i < npieces; i++) {
+    threads.emplace_back(countPiece, std::cref(path), bounds[i], bounds[i + 1],
+                         headers_only, keep_stats, std::ref(pieces[i]));
+  }
+  for(std::thread &t: threads) t.join();
+
+  for(PieceCounts &piece: pieces) {
+    if(piece.error) std::rethrow_exception(piece.error);
+    nrecs += piece.records;
+    counts += piece.counts;
+    stats += piece.stats;
+  }
+  return true;
+}
+
+// Options that apply to every file
+struct CountOptions {
+  bool include_gaps;
+  bool rec_count;
+  bool gc;
+  bool tot_bases;
+  bool gtot_bases;
+  bool composition;
+  bool stats;
+  bool make_index;
+  unsigned nthreads;
+};
+
+// What one file adds to the figures over all files (-B, -s)
+struct FileTotals {
+  uint64_t bases;
+  SeqStats stats;
+
+  explicit FileTotals(bool include_gaps) : bases(0), stats(include_gaps) {}
+};
+
+// Count one file, with its lines going to out and errors to err.
+// Returns the exit status.
+static int countFile(string &infile, const CountOptions &opt,
+                     ostream &out, ostream &err, FileTotals &totals) {
+
+  RecordView rec;              // Points into the input; no per-record copy
+  LazyRecord header;           // For plain counts; the rest isn't parsed
+  SeqFileInWrapper seq_handle;
+  uint64_t base_count = 0;
+  uint64_t total_base_count = 0;
+  uint64_t gc_count = 0;
+  Composition record;
+  Composition counts;          // Of the record with -m, else of the file
+  SeqStats file_stats(opt.include_gaps);
+
+  try {
+      seq_handle.open(infile);
+  } catch(Exception const &e) {
+    err << "Error: Could not open " << infile << endl;
+    seq_handle.close();
+    return 1;
+  }
+  
+  uint64_t nrecs_read = 0;
+
+  if(opt.make_index) {
+    try {
+      if(!seq_handle.buildIndex(true)) {
+        err << "Warning: Could not write an index for " << infile << endl;
+      }
+    } catch (Exception const &e) {
+      err << "Error: " << e.what() << endl;
+      seq_handle.close();
+      return 1;
+    }
+  }
+
+  // A plain record count can come straight from the index
+  bool count_only = !(opt.gc || opt.rec_count || opt.tot_bases || opt.gtot_bases || opt.composition || opt.stats);
+  if(count_only && (seq_handle.hasIndex() || seq_handle.loadIndex())) {
+    nrecs_read = seq_handle.recordCount();
+    seq_handle.seekRecord(nrecs_read);
+  }
+
+  // Everything but -m adds up over the file, so a large one can be
+  // counted in pieces. Per-file -b and -B totals are the same whether
+  // added up per record or per piece.
+  bool split = false;
+  if(opt.nthreads > 1 && !opt.rec_count && seq_handle.isMapped() &&
+     !seq_handle.atEnd()) {
+    try {
+      split = countSplit(infile, opt.nthreads, count_only, opt.stats, nrecs_read,
+                         counts, file_stats);
+      if(split) {
+        base_count = counts.bases(opt.include_gaps);
+        gc_count = counts.gc();
+        total_base_count = base_count;
+        if(opt.gtot_bases) totals.bases += base_count;
+      }
+    } catch (Exception const &e) {
+      err << "Error: " << e.what() << endl;
+      seq_handle.close();
+      return 1;
+    }
+  }
+
+  while(!split && !seq_handle.atEnd()) {
+
+    try {
+
+      if(count_only) {
+        seq_handle.readRecord(header);
+      } else {
+        seq_handle.readRecord(rec);
+      }
+      nrecs_read++; 
+
+    } catch (Exception const &e) {
+
+      err << "Error: " << e.what() << endl;
+      seq_handle.close();
+      return 1;
+
+    } // End try-catch for record reading.
+    
+    if(!count_only) {
+      record.clear();
+      record.add(rec.seq.begin(), rec.seq.end());
+      counts += record;
+      if(opt.stats) file_stats.add(record);
+      base_count = counts.bases(opt.include_gaps);
+      gc_count = counts.gc();
+    }
+   
+    if(opt.rec_count || opt.tot_bases || opt.gtot_bases) {
+      if(opt.composition) {
+        out << infile << "\t" << rec.id;
+        writeComposition(out, counts);
+      } else if(opt.gc) {
+        out << infile << "\t" << rec.id << "\t" << ((double)gc_count) / (base_count) << endl;
+      } else if(opt.rec_count) {
+        out << infile << "\t" << rec.id << "\t" << base_count << endl;
+      }
+      if(opt.tot_bases) {
+        total_base_count += base_count;
+      }
+      if(opt.gtot_bases) {
+        totals.bases += base_count;
+      }
+      gc_count = 0;
+      base_count = 0;
+      counts.clear();
+    } // End rec_count output
+
+  } // End single file reading loop
+
+  if(!seq_handle.close()) {
+      err << "Error: Problem closing " << infile << endl;
+      return 1;
+  }
+
+  if(opt.stats) {
+    writeStats(out, infile, file_stats);
+    totals.stats += file_stats;
+  } else if(!opt.rec_count) {
+    if(opt.composition) {
+      out << infile;
+      writeComposition(out, counts);
+    } else if (opt.tot_bases) {
+      out << infile << "\t" << total_base_count << endl;
+    } else if(opt.gc) {
+      out << infile << "\t" << ((double)gc_count) / (base_count) << endl;
+    } else {
+      out << infile << "\t" << nrecs_read << endl;
+    }
+  }
+
+  return 0;
+}
+
 int main(int argc, char * argv[]) {
   
   TCLAP::CmdLine cmd("Equivalent of `wc' for sequence files", ' ', "0.0");
@@ -41,6 +311,27 @@ int main(int argc, char * argv[]) {
                                 "Total bases per file (not compatible with -g or -m)", cmd);
   TCLAP::SwitchArg report_grand_total("B", "grand-total-bases",
                                       "Total bases across all files (not compatible with -g or -m)", cmd);
+  TCLAP::SwitchArg composition_arg("", "composition",
+                                   "Give counts of A, C, G, T (or U), N, gaps and other characters (of file or of each record with -m)",
+                                   cmd);
+  TCLAP::SwitchArg stats_arg("s", "stats",
+                              "Give records, bases, min, max and mean length, N50, L50, GC and gap proportions per file (and in total for several files)",
+                              cmd);
+  TCLAP::ValueArg<unsigned> threads_arg("t", "threads",
+                                        "Number of threads to count large files with; not used with -m",
+                                        false, 1, "int", cmd);
+  TCLAP::ValueArg<unsigned> jobs_arg("j", "jobs",
+                                     "Number of files to count at once",
+                                     false, 1, "int", cmd);
+  TCLAP::SwitchArg make_index_arg("x", "make-index",
+                                  "Write a .fai index for each input file; later record counts and bltail can use it",
+                                  cmd);
+  TCLAP::SwitchArg bgzf_arg("z", "bgzf",
+                            "Compress the output as BGZF (readable as gzip)",
+                            cmd);
+  TCLAP::ValueArg<string> gzi_arg("", "gzi",
+                                  "With -z, also write a .gzi index of the output to this file",
+                                  false, "", "file", cmd);
   TCLAP::UnlabeledMultiArg<string> files("FILE(s)", "filenames", false,
                                          "file name(s)", cmd, false);
   cmd.parse(argc, argv);
@@ -49,100 +340,50 @@ int main(int argc, char * argv[]) {
   bool gc = gc_arg.getValue();
   bool tot_bases = report_total.getValue();
   bool gtot_bases = report_grand_total.getValue();
+  bool composition = composition_arg.getValue();
+  bool stats = stats_arg.getValue();
+  bool make_index = make_index_arg.getValue();
+  unsigned nthreads = threads_arg.getValue();
+  unsigned njobs = jobs_arg.getValue();
   vector<string> infiles = files.getValue();
   if(infiles.size() == 0) infiles.push_back("-");
   if((tot_bases || gtot_bases) && (rec_count || gc)) {
       cerr << "Error: Cannot count total bases and get length per record or GC" << endl;
       return 1;
   }
+  if(composition && (gc || tot_bases || gtot_bases)) {
+      cerr << "Error: Cannot give composition with -g, -b or -B" << endl;
+      return 1;
+  }
 
-  CharString id;
-  CharString seq;              // CharString more flexible than Dna5String
-  SeqFileInWrapper seq_handle;
-  unsigned base_count = 0;
-  unsigned total_base_count = 0;
-  unsigned grand_total_base_count = 0;
-  unsigned gc_count = 0;
-
-  for(string& infile: infiles) {
-    total_base_count = 0;
-    base_count = 0;
-    gc_count = 0;
-
-    try {
-        seq_handle.open(infile);
-    } catch(Exception const &e) {
-      cerr << "Error: Could not open " << infile << endl;
-      seq_handle.close();
+  if(stats && (rec_count || gc || tot_bases || gtot_bases || composition)) {
+      cerr << "Error: Cannot give statistics with other counts" << endl;
       return 1;
-    }
-    
-    int nrecs_read = 0;
-
-    while(!seq_handle.atEnd()) {
-
-      try {
-
-        readRecord(id, seq, seq_handle.sqh);
-        nrecs_read++; 
-
-      } catch (Exception const &e) {
-
-        cerr << "Error: " << e.what() << endl;
-        seq_handle.close();
-        return 1;
-
-      } // End try-catch for record reading.
-      
-      if(gc || rec_count || tot_bases || gtot_bases) {
-        // TODO Use the size() or length() or w/e function to get the base_count
-        // unless you want to avoid counting gaps
-        for(char& b: seq) {
-          if(include_gaps || b != '-') {
-              base_count += 1;
-            if(gc) {
-              if(b == 'G' || b == 'C' || b == 'g' || b == 'c') {
-                  gc_count += 1;
-              }
-            }
-          }
-        }
-      }
-     
-      if(rec_count || tot_bases || gtot_bases) {
-        if(gc) {
-          cout << infile << "\t" << id << "\t" << ((double)gc_count) / (base_count) << endl;
-        } else if(rec_count) {
-          cout << infile << "\t" << id << "\t" << base_count << endl;
-        }
-        if(tot_bases) {
-          total_base_count += base_count;
-        }
-        if(gtot_bases) {
-          grand_total_base_count += base_count;
-        }
-        gc_count = 0;
-        base_count = 0;
-      } // End rec_count output
-
-    } // End single file reading loop
-
-    if(!seq_handle.close()) {
-        cerr << "Error: Problem closing " << infile << endl;
-        return 1;
-    }
+  }
+  std::unique_ptr<BgzfCout> compressed;    // With -z, until main returns
+  if(!compressCout(bgzf_arg.getValue(), gzi_arg.getValue(), compressed)) {
+    return 1;
+  }
 
-    if(!rec_count) {
-      if (tot_bases) {
-        cout << infile << "\t" << total_base_count << endl;
-      } else if(gc) {
-        cout << infile << "\t" << ((double)gc_count) / (base_count) << endl;
-      } else {
-        cout << infile << "\t" << nrecs_read << endl;
-      }
-    }
+  CountOptions opt = { include_gaps, rec_count, gc, tot_bases, gtot_bases,
+                       composition, stats, make_index, nthreads };
+  vector<FileTotals> totals(infiles.size(), FileTotals(include_gaps));
+  int status = runFileJobs(infiles.size(), njobs,
+                           [&](size_t i, ostream &out, ostream &err) {
+    return countFile(infiles[i], opt, out, err, totals[i]);
+  });
+  if(status != 0) return status;
 
-  } // End loop over files
+  uint64_t grand_total_base_count = 0;
+  SeqStats all_stats(include_gaps);
+  for(const FileTotals &t: totals) {
+    grand_total_base_count += t.bases;
+    all_stats += t.stats;
+  }
+
+  if(stats && infiles.size() > 1) {
+    writeStats(cout, "TOTAL", all_stats);
+  }
 
   if(gtot_bases) {
     cout << "GRAND_TOTAL_BASES" << "\t" << grand_total_base_count << endl;